@@ -0,0 +1,288 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_CACHE_WAYS_H_
+#define _I915_CACHE_WAYS_H_
+
+#include "i915_drm.h"
+#include "intel_hwconfig_klv.h"
+
+/**
+ * DOC: L3 way partitioning
+ *
+ * %PRELIM_DRM_IOCTL_I915_GEM_CLOS_RESERVE hands out a class of service,
+ * %PRELIM_DRM_IOCTL_I915_GEM_CACHE_RESERVE moves L3 ways from the shared set
+ * to it and %PRELIM_DRM_IOCTL_I915_GEM_CLOS_FREE gives everything back.
+ *
+ * The helpers below split the reservable ways among tenants by weight and
+ * bring the kernel reservations in line with the split. The pool is the
+ * %INTEL_HWCONFIG_L3_CACHE_WAYS_PER_SECTOR ways minus the
+ * %INTEL_HWCONFIG_RESERVED_CCS_WAYS and the ways kept shared for everyone
+ * else; each way is %INTEL_HWCONFIG_L3_CACHE_WAYS_SIZE_IN_BYTES large, and
+ * i915_cache_tenant_bytes() gives the size of a planned reservation.
+ *
+ * When tenants come and go, update the weights, plan again and apply: ways
+ * are first taken from tenants that shrink, then given to those that grow,
+ * so the kernel pool is never oversubscribed. A tenant whose share drops
+ * to zero releases its CLOS. Call i915_cache_release_all() on teardown, as
+ * the kernel only releases CLOS sets when the fd is closed.
+ */
+
+/**
+ * typedef i915_cache_ioctl_fn - Issue a CLOS or cache reservation ioctl
+ * @ctx: opaque pointer passed along
+ * @request: PRELIM_DRM_IOCTL_I915_GEM_CLOS_RESERVE, _CLOS_FREE or
+ *	     _CACHE_RESERVE
+ * @arg: ioctl argument
+ *
+ * Return: 0 on success or a negative error code.
+ */
+typedef int (*i915_cache_ioctl_fn)(void *ctx, unsigned long request, void *arg);
+
+#define I915_CACHE_NO_CLOS	0xffff
+
+/**
+ * struct i915_cache_tenant - One tenant of the L3
+ */
+struct i915_cache_tenant {
+	/** @weight: Relative share of the pool, 0 for none */
+	__u32 weight;
+
+	/** @target: Ways planned by i915_cache_plan() */
+	__u32 target;
+
+	/** @ways: Ways currently reserved in the kernel */
+	__u32 ways;
+
+	/** @clos_index: Reserved CLOS, or %I915_CACHE_NO_CLOS */
+	__u16 clos_index;
+
+	__u16 pad;
+};
+
+static inline void
+i915_cache_tenant_init(struct i915_cache_tenant *t, __u32 weight)
+{
+	t->weight = weight;
+	t->target = 0;
+	t->ways = 0;
+	t->clos_index = I915_CACHE_NO_CLOS;
+	t->pad = 0;
+}
+
+/**
+ * i915_cache_pool_ways - Ways available for reservation
+ * @cap: device capacity from intel_hwconfig_capacity_init()
+ * @shared_ways: ways to leave in the shared set, at least 1
+ *
+ * Return: the number of reservable ways, 0 if none.
+ */
+static inline __u32
+i915_cache_pool_ways(const struct intel_hwconfig_capacity *cap,
+		     __u32 shared_ways)
+{
+	__u32 keep = cap->reserved_ccs_ways + shared_ways;
+
+	return cap->l3_ways_per_sector > keep ? cap->l3_ways_per_sector - keep : 0;
+}
+
+/**
+ * i915_cache_tenant_bytes - Size of the planned reservation of a tenant
+ * @cap: device capacity from intel_hwconfig_capacity_init()
+ * @t: tenant planned by i915_cache_plan()
+ *
+ * Return: @t->target times the way size of @cap in bytes, 0 if the
+ * hwconfig table does not report the way size.
+ */
+static inline __u64
+i915_cache_tenant_bytes(const struct intel_hwconfig_capacity *cap,
+			const struct i915_cache_tenant *t)
+{
+	return (__u64)t->target * cap->l3_way_bytes;
+}
+
+/**
+ * i915_cache_plan - Split the pool among tenants by weight
+ * @tenants: tenants, @target is filled in
+ * @num_tenants: number of entries in @tenants
+ * @pool_ways: output of i915_cache_pool_ways()
+ *
+ * Uses largest remainder apportionment: every tenant gets the integer part
+ * of its share, and the ways left over go to the largest fractional parts,
+ * ties to the lowest index. The result only depends on the inputs.
+ */
+static inline void
+i915_cache_plan(struct i915_cache_tenant *tenants, __u32 num_tenants,
+		__u32 pool_ways)
+{
+	__u64 total = 0;
+	__u32 i, given = 0;
+
+	for (i = 0; i < num_tenants; i++)
+		total += tenants[i].weight;
+
+	for (i = 0; i < num_tenants; i++) {
+		tenants[i].target = total ?
+			(__u32)((__u64)pool_ways * tenants[i].weight / total) : 0;
+		given += tenants[i].target;
+	}
+
+	while (total && given < pool_ways) {
+		__u64 best_rem = 0;
+		__u32 best = num_tenants;
+
+		for (i = 0; i < num_tenants; i++) {
+			__u64 share = (__u64)pool_ways * tenants[i].weight;
+			__u64 rem;
+
+			/* Remainder left after the ways given so far */
+			if (share <= (__u64)tenants[i].target * total)
+				continue;
+			rem = share - (__u64)tenants[i].target * total;
+			if (rem > best_rem) {
+				best_rem = rem;
+				best = i;
+			}
+		}
+		if (best == num_tenants)
+			break;
+
+		tenants[best].target++;
+		given++;
+	}
+}
+
+static inline int
+__i915_cache_reserve(struct i915_cache_tenant *t, __u32 ways,
+		     i915_cache_ioctl_fn fn, void *ctx)
+{
+	struct prelim_drm_i915_gem_cache_reserve arg;
+	int ret;
+
+	arg.clos_index = t->clos_index;
+	arg.cache_level = 3;
+	arg.num_ways = ways;
+	arg.pad16 = 0;
+
+	ret = fn(ctx, PRELIM_DRM_IOCTL_I915_GEM_CACHE_RESERVE, &arg);
+	if (!ret)
+		t->ways = ways;
+
+	return ret;
+}
+
+static inline int
+__i915_cache_clos_free(struct i915_cache_tenant *t, i915_cache_ioctl_fn fn,
+		       void *ctx)
+{
+	struct prelim_drm_i915_gem_clos_free arg;
+	int ret;
+
+	arg.clos_index = t->clos_index;
+	arg.pad16 = 0;
+
+	ret = fn(ctx, PRELIM_DRM_IOCTL_I915_GEM_CLOS_FREE, &arg);
+	if (!ret) {
+		t->clos_index = I915_CACHE_NO_CLOS;
+		t->ways = 0;
+	}
+
+	return ret;
+}
+
+/**
+ * i915_cache_apply - Bring kernel reservations in line with the plan
+ * @tenants: tenants planned by i915_cache_plan()
+ * @num_tenants: number of entries in @tenants
+ * @fn: ioctl callback
+ * @ctx: passed to @fn
+ *
+ * A resized reservation is dropped and made again with the new size.
+ *
+ * Return: 0 on success or the first error. &i915_cache_tenant.ways and
+ * &i915_cache_tenant.clos_index always reflect the kernel state, so apply
+ * can simply be retried.
+ */
+static inline int
+i915_cache_apply(struct i915_cache_tenant *tenants, __u32 num_tenants,
+		 i915_cache_ioctl_fn fn, void *ctx)
+{
+	__u32 i;
+	int ret;
+
+	/* Shrink first so growing tenants find the ways in the shared set */
+	for (i = 0; i < num_tenants; i++) {
+		struct i915_cache_tenant *t = &tenants[i];
+
+		if (t->clos_index == I915_CACHE_NO_CLOS)
+			continue;
+
+		/* Also frees a CLOS left without ways by a failed reserve */
+		if (!t->target)
+			ret = __i915_cache_clos_free(t, fn, ctx);
+		else if (t->target >= t->ways)
+			continue;
+		else if (!(ret = __i915_cache_reserve(t, 0, fn, ctx)))
+			ret = __i915_cache_reserve(t, t->target, fn, ctx);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < num_tenants; i++) {
+		struct i915_cache_tenant *t = &tenants[i];
+
+		if (t->target <= t->ways)
+			continue;
+
+		if (t->clos_index == I915_CACHE_NO_CLOS) {
+			struct prelim_drm_i915_gem_clos_reserve arg = { 0, 0 };
+
+			ret = fn(ctx, PRELIM_DRM_IOCTL_I915_GEM_CLOS_RESERVE, &arg);
+			if (ret)
+				return ret;
+			t->clos_index = arg.clos_index;
+		}
+
+		if (t->ways && (ret = __i915_cache_reserve(t, 0, fn, ctx)))
+			return ret;
+		ret = __i915_cache_reserve(t, t->target, fn, ctx);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * i915_cache_release_all - Free every CLOS held by the tenants
+ * @tenants: tenants
+ * @num_tenants: number of entries in @tenants
+ * @fn: ioctl callback
+ * @ctx: passed to @fn
+ *
+ * Return: 0 on success or the last error; tenants whose CLOS could not be
+ * freed keep it.
+ */
+static inline int
+i915_cache_release_all(struct i915_cache_tenant *tenants, __u32 num_tenants,
+		       i915_cache_ioctl_fn fn, void *ctx)
+{
+	__u32 i;
+	int ret = 0, err;
+
+	for (i = 0; i < num_tenants; i++) {
+		tenants[i].target = 0;
+		if (tenants[i].clos_index == I915_CACHE_NO_CLOS)
+			continue;
+
+		err = __i915_cache_clos_free(&tenants[i], fn, ctx);
+		if (err)
+			ret = err;
+	}
+
+	return ret;
+}
+
+#endif /* _I915_CACHE_WAYS_H_ */
@@ -0,0 +1,329 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_DEBUG_EVENTS_H_
+#define _I915_DEBUG_EVENTS_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "i915_drm.h"
+
+/**
+ * DOC: Debugger event dispatch
+ *
+ * Each %PRELIM_I915_DEBUG_IOCTL_READ_EVENT on a debugger fd copies one
+ * event into a buffer described by a struct prelim_drm_i915_debug_event
+ * header. i915_debug_read_events() packs as many events as fit into one
+ * large caller buffer, and i915_debug_dispatch_all() walks them in place
+ * and hands each to the callback of its type in a struct
+ * i915_debug_visitor, cast to the matching event struct. Nothing is copied
+ * or allocated on the way.
+ *
+ * Events carrying %PRELIM_DRM_I915_DEBUG_EVENT_NEED_ACK are recorded in a
+ * struct i915_debug_ack_batch once their callback succeeded, and
+ * acknowledged together by i915_debug_ack_flush() after the whole buffer
+ * has been handled. The kernel still takes one
+ * %PRELIM_I915_DEBUG_IOCTL_ACK_EVENT per event; batching only keeps the
+ * acks out of the dispatch loop. Events stay in the buffer with their
+ * original alignment of 8 bytes, and all event structs are packed, so the
+ * callbacks can read them directly.
+ */
+
+/**
+ * typedef i915_debug_ioctl_fn - Issue an ioctl on the debugger fd
+ * @ctx: opaque pointer passed along
+ * @request: PRELIM_I915_DEBUG_IOCTL_*
+ * @arg: ioctl argument
+ *
+ * Return: 0 on success or a negative error code; -EAGAIN when a
+ * non-blocking fd has no event.
+ */
+typedef int (*i915_debug_ioctl_fn)(void *ctx, unsigned long request, void *arg);
+
+#define __I915_DEBUG_ALIGN(x)	(((x) + 7) & ~(size_t)7)
+
+/**
+ * i915_debug_read_events - Read events until the buffer is full
+ * @buf: destination, 8 byte aligned
+ * @size: size of @buf
+ * @fn: ioctl callback
+ * @ctx: passed to @fn
+ * @len: returns the number of bytes used in @buf
+ *
+ * Stops when no event is pending or the next one does not fit.
+ *
+ * Return: the number of events read, or the error of the first read.
+ */
+static inline int
+i915_debug_read_events(void *buf, size_t size, i915_debug_ioctl_fn fn,
+		       void *ctx, size_t *len)
+{
+	struct prelim_drm_i915_debug_event *ev;
+	size_t off = 0;
+	int count = 0, ret;
+
+	while (size - off > sizeof(*ev)) {
+		ev = (struct prelim_drm_i915_debug_event *)((__u8 *)buf + off);
+		ev->type = PRELIM_DRM_I915_DEBUG_EVENT_READ;
+		ev->flags = 0;
+		ev->seqno = 0;
+		ev->size = size - off;
+
+		ret = fn(ctx, PRELIM_I915_DEBUG_IOCTL_READ_EVENT, ev);
+		if (ret) {
+			if (!count)
+				count = ret == -EAGAIN ? 0 : ret;
+			break;
+		}
+		if (ev->size < sizeof(*ev) || ev->size > size - off)
+			break;
+
+		off = __I915_DEBUG_ALIGN(off + ev->size);
+		if (off > size)
+			off = size;
+		count++;
+	}
+
+	*len = off;
+	return count;
+}
+
+/**
+ * i915_debug_event_next - Step to the next event of a buffer
+ * @buf: buffer filled by i915_debug_read_events()
+ * @len: bytes used in @buf
+ * @offset: offset of the event to return, advanced past it
+ *
+ * Return: the event, or NULL at the end of @buf.
+ */
+static inline const struct prelim_drm_i915_debug_event *
+i915_debug_event_next(const void *buf, size_t len, size_t *offset)
+{
+	const struct prelim_drm_i915_debug_event *ev;
+
+	if (*offset > len || len - *offset < sizeof(*ev))
+		return NULL;
+
+	ev = (const struct prelim_drm_i915_debug_event *)((const __u8 *)buf + *offset);
+	if (ev->size < sizeof(*ev) || ev->size > len - *offset)
+		return NULL;
+
+	*offset = __I915_DEBUG_ALIGN(*offset + ev->size);
+	return ev;
+}
+
+/**
+ * struct i915_debug_visitor - Per type event callbacks
+ *
+ * Each callback returns 0 once the event is handled, which also queues its
+ * ack if the event needs one, or a negative error code to stop dispatch.
+ * NULL callbacks fall back to @other, and events without any callback are
+ * skipped, but still acknowledged.
+ */
+struct i915_debug_visitor {
+	int (*client)(void *ctx, const struct prelim_drm_i915_debug_event_client *ev);
+	int (*context)(void *ctx, const struct prelim_drm_i915_debug_event_context *ev);
+	int (*uuid)(void *ctx, const struct prelim_drm_i915_debug_event_uuid *ev);
+	int (*vm)(void *ctx, const struct prelim_drm_i915_debug_event_vm *ev);
+	int (*vm_bind)(void *ctx, const struct prelim_drm_i915_debug_event_vm_bind *ev);
+	int (*context_param)(void *ctx, const struct prelim_drm_i915_debug_event_context_param *ev);
+	int (*eu_attention)(void *ctx, const struct prelim_drm_i915_debug_event_eu_attention *ev);
+	int (*engines)(void *ctx, const struct prelim_drm_i915_debug_event_engines *ev);
+	int (*page_fault)(void *ctx, const struct prelim_drm_i915_debug_event_page_fault *ev);
+
+	/** @other: Unknown types and types without a callback */
+	int (*other)(void *ctx, const struct prelim_drm_i915_debug_event *ev);
+};
+
+/**
+ * struct i915_debug_ack_batch - Acks waiting to be sent
+ */
+struct i915_debug_ack_batch {
+	/** @acks: Caller-owned storage */
+	struct prelim_drm_i915_debug_event_ack *acks;
+
+	/** @count: Number of pending acks */
+	__u32 count;
+
+	/** @max: Capacity of @acks */
+	__u32 max;
+};
+
+static inline void
+i915_debug_ack_init(struct i915_debug_ack_batch *batch,
+		    struct prelim_drm_i915_debug_event_ack *acks, __u32 max)
+{
+	batch->acks = acks;
+	batch->count = 0;
+	batch->max = max;
+}
+
+/**
+ * i915_debug_ack_add - Queue the ack of an event
+ * @batch: batch
+ * @ev: event with %PRELIM_DRM_I915_DEBUG_EVENT_NEED_ACK
+ *
+ * Return: 0 on success, -ENOSPC if the batch is full.
+ */
+static inline int
+i915_debug_ack_add(struct i915_debug_ack_batch *batch,
+		   const struct prelim_drm_i915_debug_event *ev)
+{
+	struct prelim_drm_i915_debug_event_ack *ack;
+
+	if (batch->count == batch->max)
+		return -ENOSPC;
+
+	ack = &batch->acks[batch->count++];
+	ack->type = ev->type;
+	ack->flags = 0;
+	ack->seqno = ev->seqno;
+	return 0;
+}
+
+/**
+ * i915_debug_ack_flush - Send all queued acks
+ * @batch: batch
+ * @fn: ioctl callback
+ * @ctx: passed to @fn
+ *
+ * Return: 0 on success. On error the failed ack and the ones after it stay
+ * queued and the negative error code is returned.
+ */
+static inline int
+i915_debug_ack_flush(struct i915_debug_ack_batch *batch,
+		     i915_debug_ioctl_fn fn, void *ctx)
+{
+	__u32 i;
+	int ret = 0;
+
+	for (i = 0; i < batch->count; i++) {
+		ret = fn(ctx, PRELIM_I915_DEBUG_IOCTL_ACK_EVENT, &batch->acks[i]);
+		if (ret)
+			break;
+	}
+
+	memmove(batch->acks, batch->acks + i,
+		(batch->count - i) * sizeof(batch->acks[0]));
+	batch->count -= i;
+	return ret;
+}
+
+#define __I915_DEBUG_VISIT(v, cb, ctx, type, ev) \
+	((v)->cb ? (v)->cb((ctx), (const struct type *)(ev)) : \
+	 (v)->other ? (v)->other((ctx), (ev)) : 0)
+
+/**
+ * i915_debug_dispatch - Hand one event to its callback
+ * @v: visitor
+ * @ctx: passed to the callback
+ * @ev: event
+ * @acks: where to queue the ack of @ev if it needs one, may be NULL
+ *
+ * Return: 0 on success, the error of the callback, or -ENOSPC if @acks is
+ * full, in which case the callback has already run.
+ */
+static inline int
+i915_debug_dispatch(const struct i915_debug_visitor *v, void *ctx,
+		    const struct prelim_drm_i915_debug_event *ev,
+		    struct i915_debug_ack_batch *acks)
+{
+	int ret;
+
+	switch (ev->type) {
+	case PRELIM_DRM_I915_DEBUG_EVENT_CLIENT:
+		ret = __I915_DEBUG_VISIT(v, client, ctx, prelim_drm_i915_debug_event_client, ev);
+		break;
+	case PRELIM_DRM_I915_DEBUG_EVENT_CONTEXT:
+		ret = __I915_DEBUG_VISIT(v, context, ctx, prelim_drm_i915_debug_event_context, ev);
+		break;
+	case PRELIM_DRM_I915_DEBUG_EVENT_UUID:
+		ret = __I915_DEBUG_VISIT(v, uuid, ctx, prelim_drm_i915_debug_event_uuid, ev);
+		break;
+	case PRELIM_DRM_I915_DEBUG_EVENT_VM:
+		ret = __I915_DEBUG_VISIT(v, vm, ctx, prelim_drm_i915_debug_event_vm, ev);
+		break;
+	case PRELIM_DRM_I915_DEBUG_EVENT_VM_BIND:
+		ret = __I915_DEBUG_VISIT(v, vm_bind, ctx, prelim_drm_i915_debug_event_vm_bind, ev);
+		break;
+	case PRELIM_DRM_I915_DEBUG_EVENT_CONTEXT_PARAM:
+		ret = __I915_DEBUG_VISIT(v, context_param, ctx, prelim_drm_i915_debug_event_context_param, ev);
+		break;
+	case PRELIM_DRM_I915_DEBUG_EVENT_EU_ATTENTION:
+		ret = __I915_DEBUG_VISIT(v, eu_attention, ctx, prelim_drm_i915_debug_event_eu_attention, ev);
+		break;
+	case PRELIM_DRM_I915_DEBUG_EVENT_ENGINES:
+		ret = __I915_DEBUG_VISIT(v, engines, ctx, prelim_drm_i915_debug_event_engines, ev);
+		break;
+	case PRELIM_DRM_I915_DEBUG_EVENT_PAGE_FAULT:
+		ret = __I915_DEBUG_VISIT(v, page_fault, ctx, prelim_drm_i915_debug_event_page_fault, ev);
+		break;
+	default:
+		ret = v->other ? v->other(ctx, ev) : 0;
+		break;
+	}
+
+	if (!ret && acks && ev->flags & PRELIM_DRM_I915_DEBUG_EVENT_NEED_ACK)
+		ret = i915_debug_ack_add(acks, ev);
+
+	return ret;
+}
+
+/**
+ * i915_debug_dispatch_all - Dispatch every event of a buffer
+ * @v: visitor
+ * @ctx: passed to the callbacks
+ * @buf: buffer filled by i915_debug_read_events()
+ * @len: bytes used in @buf
+ * @acks: where to queue acks, may be NULL
+ *
+ * Return: the number of events dispatched, or the first error of
+ * i915_debug_dispatch().
+ */
+static inline int
+i915_debug_dispatch_all(const struct i915_debug_visitor *v, void *ctx,
+			const void *buf, size_t len,
+			struct i915_debug_ack_batch *acks)
+{
+	const struct prelim_drm_i915_debug_event *ev;
+	size_t off = 0;
+	int count = 0, ret;
+
+	while ((ev = i915_debug_event_next(buf, len, &off))) {
+		ret = i915_debug_dispatch(v, ctx, ev, acks);
+		if (ret)
+			return ret;
+		count++;
+	}
+
+	return count;
+}
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+
+/**
+ * i915_debug_ioctl - &i915_debug_ioctl_fn backed by a debugger fd
+ * @ctx: pointer to an int holding the fd from %PRELIM_DRM_IOCTL_I915_DEBUGGER_OPEN
+ * @request: PRELIM_I915_DEBUG_IOCTL_*
+ * @arg: ioctl argument
+ */
+static inline int
+i915_debug_ioctl(void *ctx, unsigned long request, void *arg)
+{
+	int fd = *(int *)ctx;
+	int ret;
+
+	do {
+		ret = ioctl(fd, request, arg);
+	} while (ret == -1 && errno == EINTR);
+
+	return ret ? -errno : 0;
+}
+#endif
+
+#endif /* _I915_DEBUG_EVENTS_H_ */
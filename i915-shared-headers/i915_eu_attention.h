@@ -0,0 +1,309 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_EU_ATTENTION_H_
+#define _I915_EU_ATTENTION_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "i915_drm.h"
+#include "i915_topology.h"
+
+/**
+ * DOC: EU attention bitmaps
+ *
+ * &prelim_drm_i915_debug_event_eu_attention.bitmask,
+ * &prelim_drm_i915_debug_eu_control.bitmask_ptr and each third of
+ * &prelim_drm_i915_debug_event_page_fault.bitmask hold one byte per EU,
+ * one bit per hardware thread, in the natural order of slice, subslice and
+ * EU given by struct drm_i915_query_topology_info. Fused off units keep
+ * their place.
+ *
+ * On dual subslice parts the EUs run in lockstepped pairs and the bitmask
+ * has one byte per pair, so it only covers half of the topology EU count.
+ * struct i915_attn_geometry records this with @lockstep = 2, and
+ * coordinates then name the first EU of the pair.
+ *
+ * The bitmap operations work a 64-bit word at a time in straight loops
+ * that the compiler vectorises, and iteration skips zero words, so walking
+ * a mostly empty bitmap of thousands of EUs only touches the set bits.
+ */
+
+#define I915_ATTN_THREADS	8
+
+/**
+ * struct i915_attn_geometry - Shape of an attention bitmap
+ */
+struct i915_attn_geometry {
+	__u32 max_slices;
+	__u32 max_subslices;
+
+	/** @eus: Bitmap bytes per subslice */
+	__u32 eus;
+
+	/** @lockstep: Logical EUs per bitmap byte, 1 or 2 */
+	__u32 lockstep;
+};
+
+/**
+ * struct i915_attn_coord - Location of one attention bit
+ */
+struct i915_attn_coord {
+	__u32 slice;
+	__u32 subslice;
+
+	/** @eu: Logical EU index, the first of the pair with lockstep */
+	__u32 eu;
+
+	__u32 thread;
+};
+
+/**
+ * i915_attn_geometry_init - Derive the bitmap shape from the topology
+ * @geo: geometry to fill
+ * @info: %DRM_I915_QUERY_TOPOLOGY_INFO result
+ * @lockstep: 2 on dual subslice parts, 1 otherwise
+ */
+static inline void
+i915_attn_geometry_init(struct i915_attn_geometry *geo,
+			const struct drm_i915_query_topology_info *info,
+			__u32 lockstep)
+{
+	geo->max_slices = info->max_slices;
+	geo->max_subslices = info->max_subslices;
+	geo->lockstep = lockstep;
+	geo->eus = info->max_eus_per_subslice / lockstep;
+}
+
+/**
+ * i915_attn_size - Bitmap size in bytes, as in bitmask_size
+ * @geo: geometry
+ */
+static inline __u32
+i915_attn_size(const struct i915_attn_geometry *geo)
+{
+	return geo->max_slices * geo->max_subslices * geo->eus *
+	       I915_ATTN_THREADS / 8;
+}
+
+/**
+ * i915_attn_bit_to_coord - Locate a bit
+ * @geo: geometry
+ * @bit: bit index in the bitmap
+ * @c: returns the coordinates
+ */
+static inline void
+i915_attn_bit_to_coord(const struct i915_attn_geometry *geo, __u32 bit,
+		       struct i915_attn_coord *c)
+{
+	__u32 row = bit / I915_ATTN_THREADS;
+	__u32 ss = row / geo->eus;
+
+	c->thread = bit % I915_ATTN_THREADS;
+	c->eu = row % geo->eus * geo->lockstep;
+	c->subslice = ss % geo->max_subslices;
+	c->slice = ss / geo->max_subslices;
+}
+
+/**
+ * i915_attn_bit - Bit index of a coordinate
+ * @geo: geometry
+ * @c: coordinates; with lockstep either EU of the pair may be named
+ */
+static inline __u32
+i915_attn_bit(const struct i915_attn_geometry *geo,
+	      const struct i915_attn_coord *c)
+{
+	return ((c->slice * geo->max_subslices + c->subslice) * geo->eus +
+		c->eu / geo->lockstep) * I915_ATTN_THREADS + c->thread;
+}
+
+/**
+ * i915_attn_enabled_mask - Bitmap of the threads that exist
+ * @geo: geometry
+ * @table: output of i915_topology_decode()
+ * @mask: i915_attn_size() bytes, receives all threads of enabled EUs
+ *
+ * A lockstepped pair is enabled if either of its EUs is.
+ */
+static inline void
+i915_attn_enabled_mask(const struct i915_attn_geometry *geo,
+		       const struct i915_topology_subslice *table, __u8 *mask)
+{
+	__u32 ss, row, n = geo->max_slices * geo->max_subslices;
+	__u64 pair = (1ull << geo->lockstep) - 1;
+
+	for (ss = 0; ss < n; ss++) {
+		for (row = 0; row < geo->eus; row++)
+			mask[ss * geo->eus + row] =
+				table[ss].eu_mask >> (row * geo->lockstep) & pair ? 0xff : 0;
+	}
+}
+
+static inline __u64
+__i915_attn_load(const __u8 *p)
+{
+	__u64 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void
+__i915_attn_store(__u8 *p, __u64 v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+/**
+ * i915_attn_and - @dst = @a & @b
+ * @dst: result, may alias @a or @b
+ * @a: bitmap
+ * @b: bitmap
+ * @size: size of the bitmaps in bytes
+ */
+static inline void
+i915_attn_and(__u8 *dst, const __u8 *a, const __u8 *b, __u32 size)
+{
+	__u32 i;
+
+	for (i = 0; i + 8 <= size; i += 8)
+		__i915_attn_store(dst + i, __i915_attn_load(a + i) & __i915_attn_load(b + i));
+	for (; i < size; i++)
+		dst[i] = a[i] & b[i];
+}
+
+/**
+ * i915_attn_andnot - @dst = @a & ~@b
+ * @dst: result, may alias @a or @b
+ * @a: bitmap
+ * @b: bitmap
+ * @size: size of the bitmaps in bytes
+ */
+static inline void
+i915_attn_andnot(__u8 *dst, const __u8 *a, const __u8 *b, __u32 size)
+{
+	__u32 i;
+
+	for (i = 0; i + 8 <= size; i += 8)
+		__i915_attn_store(dst + i, __i915_attn_load(a + i) & ~__i915_attn_load(b + i));
+	for (; i < size; i++)
+		dst[i] = a[i] & ~b[i];
+}
+
+/**
+ * i915_attn_popcount - Number of set bits
+ * @a: bitmap
+ * @size: size of @a in bytes
+ */
+static inline __u32
+i915_attn_popcount(const __u8 *a, __u32 size)
+{
+	__u32 i, count = 0;
+
+	for (i = 0; i + 8 <= size; i += 8)
+		count += __builtin_popcountll(__i915_attn_load(a + i));
+	for (; i < size; i++)
+		count += __builtin_popcount(a[i]);
+
+	return count;
+}
+
+/**
+ * i915_attn_next - Find the next set bit
+ * @a: bitmap
+ * @size: size of @a in bytes
+ * @from: first bit index to consider
+ *
+ * Iterate with ``for (bit = i915_attn_next(a, size, 0); bit >= 0;
+ * bit = i915_attn_next(a, size, bit + 1))``.
+ *
+ * Return: the index of the first set bit at or after @from, or -1.
+ */
+static inline long
+i915_attn_next(const __u8 *a, __u32 size, __u32 from)
+{
+	__u32 i = from / 8 & ~7u;
+	__u64 w;
+
+	if (from >= size * 8)
+		return -1;
+
+	/* First word, with the bits below @from cleared */
+	if (i + 8 <= size) {
+		w = __i915_attn_load(a + i) & (~0ull << (from - i * 8));
+		for (;;) {
+			if (w)
+				return i * 8 + __builtin_ctzll(w);
+			i += 8;
+			if (i + 8 > size)
+				break;
+			w = __i915_attn_load(a + i);
+		}
+		from = i * 8;
+	}
+
+	for (i = from / 8; i < size; i++) {
+		w = a[i] & (0xffu << (i == from / 8 ? from % 8 : 0));
+		if (w)
+			return i * 8 + __builtin_ctz((__u32)w);
+	}
+
+	return -1;
+}
+
+/**
+ * i915_attn_diff - Compare two successive attention bitmaps
+ * @prev: previous bitmap
+ * @cur: current bitmap
+ * @raised: receives @cur & ~@prev, threads that newly stopped, may be NULL
+ * @cleared: receives @prev & ~@cur, threads that resumed, may be NULL
+ * @size: size of the bitmaps in bytes
+ *
+ * Return: non-zero if the bitmaps differ.
+ */
+static inline int
+i915_attn_diff(const __u8 *prev, const __u8 *cur, __u8 *raised,
+	       __u8 *cleared, __u32 size)
+{
+	if (raised)
+		i915_attn_andnot(raised, cur, prev, size);
+	if (cleared)
+		i915_attn_andnot(cleared, prev, cur, size);
+
+	return memcmp(prev, cur, size) != 0;
+}
+
+/**
+ * i915_attn_page_fault_split - Locate the three bitmaps of a page fault
+ * @ev: page fault event
+ * @before: returns the threads in attention before the fault
+ * @after: returns the threads in attention after the fault
+ * @resolved: returns the threads whose fault was resolved
+ *
+ * Return: the size of each bitmap in bytes, or -EINVAL if
+ * &prelim_drm_i915_debug_event_page_fault.bitmask_size is not a multiple
+ * of 3 or exceeds the event.
+ */
+static inline int
+i915_attn_page_fault_split(const struct prelim_drm_i915_debug_event_page_fault *ev,
+			   const __u8 **before, const __u8 **after,
+			   const __u8 **resolved)
+{
+	__u32 size = ev->bitmask_size / 3;
+
+	if (ev->bitmask_size % 3 ||
+	    ev->base.size < sizeof(*ev) + (__u64)ev->bitmask_size)
+		return -EINVAL;
+
+	*before = ev->bitmask;
+	*after = ev->bitmask + size;
+	*resolved = ev->bitmask + 2 * size;
+	return size;
+}
+
+#endif /* _I915_EU_ATTENTION_H_ */
@@ -0,0 +1,424 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_EU_STALL_H_
+#define _I915_EU_STALL_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "i915_drm.h"
+
+/**
+ * DOC: EU stall sampling profiles
+ *
+ * A stream opened with %PRELIM_I915_PERF_FLAG_FD_EU_STALL returns rows of
+ * %I915_EU_STALL_ROW_SIZE bytes. The hardware part of a row holds the
+ * instruction pointer of the sampled thread and one 8-bit count per stall
+ * reason; the driver stores a struct prelim_drm_i915_stall_cntr_info with
+ * the subslice that produced the row at %I915_EU_STALL_INFO_OFFSET.
+ *
+ * struct i915_eu_stall_profile accumulates rows into per (subslice, IP)
+ * totals. It is split into shards selected by subslice, each an open
+ * addressing hash table over caller-provided entries with its own
+ * struct i915_eu_stall_shard_stats, so rows from different subslices can
+ * be aggregated by different threads, one shard each, without sharing
+ * any written memory. Rows flagged with
+ * %PRELIM_I915_EUSTALL_FLAG_OVERFLOW_DROP are counted: they mean the
+ * hardware dropped data before that row. i915_eu_stall_profile_stats()
+ * sums the counters of all shards once the threads are done.
+ *
+ * i915_eu_stall_profile_write() serialises a profile into a flat blob and
+ * i915_eu_stall_profile_merge() adds such a blob into another profile, so
+ * profiles of several tiles or runs can be combined.
+ */
+
+#define I915_EU_STALL_ROW_SIZE		64
+#define I915_EU_STALL_INFO_OFFSET	(I915_EU_STALL_ROW_SIZE - \
+					 sizeof(struct prelim_drm_i915_stall_cntr_info))
+
+/**
+ * enum i915_eu_stall_reason - Stall reasons, in row order
+ */
+enum i915_eu_stall_reason {
+	I915_EU_STALL_ACTIVE,
+	I915_EU_STALL_OTHER,
+	I915_EU_STALL_CONTROL,
+	I915_EU_STALL_PIPESTALL,
+	I915_EU_STALL_SEND,
+	I915_EU_STALL_DIST_ACC,
+	I915_EU_STALL_SBID,
+	I915_EU_STALL_SYNC,
+	I915_EU_STALL_INST_FETCH,
+	I915_EU_STALL_REASONS
+};
+
+/**
+ * struct i915_eu_stall_row - One decoded row
+ */
+struct i915_eu_stall_row {
+	/** @ip: Instruction pointer, in units of instructions */
+	__u32 ip;
+
+	/** @subslice: &prelim_drm_i915_stall_cntr_info.subslice */
+	__u16 subslice;
+
+	/** @flags: &prelim_drm_i915_stall_cntr_info.flags */
+	__u16 flags;
+
+	/** @count: Samples per &enum i915_eu_stall_reason */
+	__u8 count[I915_EU_STALL_REASONS];
+};
+
+/**
+ * i915_eu_stall_row_decode - Decode one row
+ * @row: %I915_EU_STALL_ROW_SIZE bytes
+ * @out: decoded row
+ *
+ * The IP takes the low 29 bits of the row, followed by one 8-bit count
+ * per stall reason.
+ */
+static inline void
+i915_eu_stall_row_decode(const void *row, struct i915_eu_stall_row *out)
+{
+	struct prelim_drm_i915_stall_cntr_info info;
+	const __u8 *p = (const __u8 *)row;
+	__u64 lo, hi;
+	__u32 i;
+
+	memcpy(&lo, p, sizeof(lo));
+	memcpy(&hi, p + 8, sizeof(hi));
+	memcpy(&info, p + I915_EU_STALL_INFO_OFFSET, sizeof(info));
+
+	out->ip = lo & ((1u << 29) - 1);
+	for (i = 0; i < I915_EU_STALL_REASONS; i++) {
+		__u32 bit = 29 + 8 * i;
+
+		if (bit >= 64)
+			out->count[i] = hi >> (bit - 64);
+		else if (bit + 8 <= 64)
+			out->count[i] = lo >> bit;
+		else
+			out->count[i] = lo >> bit | hi << (64 - bit);
+	}
+	out->subslice = info.subslice;
+	out->flags = info.flags;
+}
+
+/**
+ * struct i915_eu_stall_entry - Totals of one (subslice, IP) pair
+ */
+struct i915_eu_stall_entry {
+	__u32 ip;
+	__u16 subslice;
+	__u16 used;
+	__u64 count[I915_EU_STALL_REASONS];
+};
+
+/**
+ * struct i915_eu_stall_shard_stats - Counters of one shard
+ *
+ * Padded to a cache line so that threads updating different shards do
+ * not share one.
+ */
+struct i915_eu_stall_shard_stats {
+	/** @rows: Rows accumulated */
+	__u64 rows;
+
+	/** @overflow_drops: Rows with %PRELIM_I915_EUSTALL_FLAG_OVERFLOW_DROP */
+	__u64 overflow_drops;
+
+	__u64 pad[6];
+};
+
+/**
+ * struct i915_eu_stall_profile - Sharded per IP stall totals
+ */
+struct i915_eu_stall_profile {
+	/** @entries: @num_shards tables of @shard_size entries */
+	struct i915_eu_stall_entry *entries;
+
+	/** @stats: @num_shards counter blocks */
+	struct i915_eu_stall_shard_stats *stats;
+
+	/** @shard_size: Entries per shard, a power of two */
+	__u32 shard_size;
+
+	/** @num_shards: Number of shards */
+	__u32 num_shards;
+};
+
+/**
+ * i915_eu_stall_profile_init - Set up an empty profile
+ * @profile: profile to initialise
+ * @entries: storage for @num_shards * @shard_size entries
+ * @stats: storage for @num_shards counter blocks, best cache line aligned
+ * @shard_size: entries per shard, a power of two
+ * @num_shards: number of shards, at least 1
+ *
+ * Return: 0 on success, -EINVAL if @shard_size is not a power of two.
+ */
+static inline int
+i915_eu_stall_profile_init(struct i915_eu_stall_profile *profile,
+			   struct i915_eu_stall_entry *entries,
+			   struct i915_eu_stall_shard_stats *stats,
+			   __u32 shard_size, __u32 num_shards)
+{
+	if (!shard_size || shard_size & (shard_size - 1) || !num_shards)
+		return -EINVAL;
+
+	memset(entries, 0, (size_t)shard_size * num_shards * sizeof(*entries));
+	memset(stats, 0, (size_t)num_shards * sizeof(*stats));
+	profile->entries = entries;
+	profile->stats = stats;
+	profile->shard_size = shard_size;
+	profile->num_shards = num_shards;
+	return 0;
+}
+
+/**
+ * i915_eu_stall_profile_stats - Sum the counters of all shards
+ * @profile: profile, not being updated concurrently
+ * @rows: returns the rows accumulated
+ * @overflow_drops: returns the rows flagged with
+ *		    %PRELIM_I915_EUSTALL_FLAG_OVERFLOW_DROP
+ */
+static inline void
+i915_eu_stall_profile_stats(const struct i915_eu_stall_profile *profile,
+			    __u64 *rows, __u64 *overflow_drops)
+{
+	__u32 i;
+
+	*rows = 0;
+	*overflow_drops = 0;
+	for (i = 0; i < profile->num_shards; i++) {
+		*rows += profile->stats[i].rows;
+		*overflow_drops += profile->stats[i].overflow_drops;
+	}
+}
+
+/**
+ * i915_eu_stall_profile_entry - Find or insert the entry of a pair
+ * @profile: profile
+ * @subslice: subslice
+ * @ip: instruction pointer
+ *
+ * Return: the entry, or NULL if the shard of @subslice is full.
+ */
+static inline struct i915_eu_stall_entry *
+i915_eu_stall_profile_entry(struct i915_eu_stall_profile *profile,
+			    __u16 subslice, __u32 ip)
+{
+	struct i915_eu_stall_entry *shard = profile->entries +
+		(size_t)(subslice % profile->num_shards) * profile->shard_size;
+	__u32 mask = profile->shard_size - 1;
+	__u32 h = (ip * 0x9e3779b1u ^ subslice) & mask;
+	__u32 i;
+
+	for (i = 0; i <= mask; i++, h = (h + 1) & mask) {
+		struct i915_eu_stall_entry *e = &shard[h];
+
+		if (!e->used) {
+			e->used = 1;
+			e->ip = ip;
+			e->subslice = subslice;
+			return e;
+		}
+
+		if (e->ip == ip && e->subslice == subslice)
+			return e;
+	}
+
+	return NULL;
+}
+
+/**
+ * i915_eu_stall_profile_add - Accumulate one decoded row
+ * @profile: profile
+ * @row: decoded row
+ *
+ * Only touches the entries and counters of the shard of @row->subslice,
+ * so threads adding rows of distinct shards need no locking.
+ *
+ * Return: 0 on success, -ENOSPC if the shard is full. A row that does not
+ * fit is not counted at all, including its overflow drop flag.
+ */
+static inline int
+i915_eu_stall_profile_add(struct i915_eu_stall_profile *profile,
+			  const struct i915_eu_stall_row *row)
+{
+	struct i915_eu_stall_shard_stats *stats =
+		&profile->stats[row->subslice % profile->num_shards];
+	struct i915_eu_stall_entry *e;
+	__u32 i;
+
+	e = i915_eu_stall_profile_entry(profile, row->subslice, row->ip);
+	if (!e)
+		return -ENOSPC;
+
+	for (i = 0; i < I915_EU_STALL_REASONS; i++)
+		e->count[i] += row->count[i];
+	stats->rows++;
+	if (row->flags & PRELIM_I915_EUSTALL_FLAG_OVERFLOW_DROP)
+		stats->overflow_drops++;
+
+	return 0;
+}
+
+/**
+ * i915_eu_stall_profile_parse - Accumulate the rows read from the stream
+ * @profile: profile
+ * @data: rows
+ * @len: size of @data, trailing bytes of a partial row are ignored
+ *
+ * Return: the number of rows accumulated, or -ENOSPC if a shard filled up.
+ */
+static inline int
+i915_eu_stall_profile_parse(struct i915_eu_stall_profile *profile,
+			    const void *data, size_t len)
+{
+	struct i915_eu_stall_row row;
+	size_t off;
+	int ret;
+
+	for (off = 0; len - off >= I915_EU_STALL_ROW_SIZE; off += I915_EU_STALL_ROW_SIZE) {
+		i915_eu_stall_row_decode((const __u8 *)data + off, &row);
+		ret = i915_eu_stall_profile_add(profile, &row);
+		if (ret)
+			return ret;
+	}
+
+	return off / I915_EU_STALL_ROW_SIZE;
+}
+
+#define I915_EU_STALL_PROFILE_MAGIC	0x53553931	/* "19US" */
+#define I915_EU_STALL_PROFILE_VERSION	1
+
+/**
+ * struct i915_eu_stall_profile_header - Serialised profile
+ *
+ * Followed by @num_entries struct i915_eu_stall_entry, in no particular
+ * order. All fields are in host byte order.
+ */
+struct i915_eu_stall_profile_header {
+	__u32 magic;
+	__u32 version;
+	__u32 num_reasons;
+	__u32 num_entries;
+	__u64 rows;
+	__u64 overflow_drops;
+};
+
+static inline __u32
+__i915_eu_stall_profile_used(const struct i915_eu_stall_profile *profile)
+{
+	size_t i, n = (size_t)profile->shard_size * profile->num_shards;
+	__u32 used = 0;
+
+	for (i = 0; i < n; i++)
+		used += profile->entries[i].used;
+
+	return used;
+}
+
+/**
+ * i915_eu_stall_profile_size - Bytes needed to serialise a profile
+ * @profile: profile
+ */
+static inline size_t
+i915_eu_stall_profile_size(const struct i915_eu_stall_profile *profile)
+{
+	return sizeof(struct i915_eu_stall_profile_header) +
+	       __i915_eu_stall_profile_used(profile) *
+	       sizeof(struct i915_eu_stall_entry);
+}
+
+/**
+ * i915_eu_stall_profile_write - Serialise a profile
+ * @profile: profile
+ * @buf: destination
+ * @size: size of @buf
+ *
+ * Return: the number of bytes written, or -ENOSPC if @size is smaller than
+ * i915_eu_stall_profile_size().
+ */
+static inline long
+i915_eu_stall_profile_write(const struct i915_eu_stall_profile *profile,
+			    void *buf, size_t size)
+{
+	struct i915_eu_stall_profile_header hdr;
+	size_t i, n = (size_t)profile->shard_size * profile->num_shards;
+	__u8 *p = (__u8 *)buf + sizeof(hdr);
+
+	if (size < i915_eu_stall_profile_size(profile))
+		return -ENOSPC;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = I915_EU_STALL_PROFILE_MAGIC;
+	hdr.version = I915_EU_STALL_PROFILE_VERSION;
+	hdr.num_reasons = I915_EU_STALL_REASONS;
+	i915_eu_stall_profile_stats(profile, &hdr.rows, &hdr.overflow_drops);
+
+	for (i = 0; i < n; i++) {
+		if (!profile->entries[i].used)
+			continue;
+		memcpy(p, &profile->entries[i], sizeof(profile->entries[i]));
+		p += sizeof(profile->entries[i]);
+		hdr.num_entries++;
+	}
+	memcpy(buf, &hdr, sizeof(hdr));
+
+	return p - (__u8 *)buf;
+}
+
+/**
+ * i915_eu_stall_profile_merge - Add a serialised profile into a profile
+ * @profile: destination
+ * @buf: output of i915_eu_stall_profile_write()
+ * @size: size of @buf
+ *
+ * Must not run concurrently with other updates of @profile. The row and
+ * overflow drop counts of @buf are added to the first shard.
+ *
+ * Return: 0 on success, -EINVAL if @buf is not a valid profile, -ENOSPC if
+ * a shard of @profile filled up; entries before that point are merged.
+ */
+static inline int
+i915_eu_stall_profile_merge(struct i915_eu_stall_profile *profile,
+			    const void *buf, size_t size)
+{
+	struct i915_eu_stall_profile_header hdr;
+	const __u8 *p = (const __u8 *)buf + sizeof(hdr);
+	__u32 i, j;
+
+	if (size < sizeof(hdr))
+		return -EINVAL;
+
+	memcpy(&hdr, buf, sizeof(hdr));
+	if (hdr.magic != I915_EU_STALL_PROFILE_MAGIC ||
+	    hdr.version != I915_EU_STALL_PROFILE_VERSION ||
+	    hdr.num_reasons != I915_EU_STALL_REASONS ||
+	    (size - sizeof(hdr)) / sizeof(struct i915_eu_stall_entry) < hdr.num_entries)
+		return -EINVAL;
+
+	for (i = 0; i < hdr.num_entries; i++) {
+		struct i915_eu_stall_entry src, *dst;
+
+		memcpy(&src, p + (size_t)i * sizeof(src), sizeof(src));
+		dst = i915_eu_stall_profile_entry(profile, src.subslice, src.ip);
+		if (!dst)
+			return -ENOSPC;
+
+		for (j = 0; j < I915_EU_STALL_REASONS; j++)
+			dst->count[j] += src.count[j];
+	}
+
+	profile->stats[0].rows += hdr.rows;
+	profile->stats[0].overflow_drops += hdr.overflow_drops;
+	return 0;
+}
+
+#endif /* _I915_EU_STALL_H_ */
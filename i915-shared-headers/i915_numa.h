@@ -0,0 +1,297 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_NUMA_H_
+#define _I915_NUMA_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "i915_drm.h"
+
+/**
+ * DOC: NUMA memory policy
+ *
+ * A &prelim_drm_i915_gem_create_ext_memory_policy extension steers the
+ * system memory backing of an object to a set of NUMA nodes. The nodemask is
+ * a bitmap of unsigned longs covering the node ids [0, nodemask_max), the
+ * same layout as for mbind(2).
+ *
+ * struct i915_numa_topology records the online nodes and the node the card
+ * is attached to, as reported by sysfs for its PCI device. From it
+ * i915_numa_policy_fill() builds the extension for one allocation class:
+ *
+ * - %I915_NUMA_NEAR_DEVICE prefers the node of the card and lets the kernel
+ *   fall back elsewhere, the usual choice for system memory fallbacks.
+ * - %I915_NUMA_DEVICE_ONLY binds to the node of the card and fails instead.
+ * - %I915_NUMA_SPREAD interleaves over all online nodes.
+ * - %I915_NUMA_CPU_LOCAL places memory close to the CPU of the first access.
+ *
+ * On a machine without NUMA, or when the card has no node, the first class
+ * degrades to the kernel default and the second fails with -ENODEV.
+ */
+
+#define I915_NUMA_MAX_NODES	1024
+#define I915_NUMA_MASK_WORDS	(I915_NUMA_MAX_NODES / 64)
+
+/**
+ * struct i915_numa_nodemask - Set of NUMA node ids
+ */
+struct i915_numa_nodemask {
+	__u64 bits[I915_NUMA_MASK_WORDS];
+};
+
+static inline void
+i915_numa_mask_set(struct i915_numa_nodemask *m, __u32 node)
+{
+	m->bits[node / 64] |= 1ull << (node % 64);
+}
+
+static inline int
+i915_numa_mask_test(const struct i915_numa_nodemask *m, __u32 node)
+{
+	return node < I915_NUMA_MAX_NODES && m->bits[node / 64] >> (node % 64) & 1;
+}
+
+/**
+ * i915_numa_mask_max - Exclusive upper bound of the node ids in a mask
+ * @m: mask
+ *
+ * Return: the highest node id plus one, 0 for an empty mask.
+ */
+static inline __u32
+i915_numa_mask_max(const struct i915_numa_nodemask *m)
+{
+	__u32 i;
+
+	for (i = I915_NUMA_MASK_WORDS; i--; ) {
+		if (m->bits[i])
+			return i * 64 + 64 - __builtin_clzll(m->bits[i]);
+	}
+
+	return 0;
+}
+
+/**
+ * i915_numa_parse_list - Parse a sysfs node list such as "0-3,8"
+ * @s: NUL-terminated list, a trailing newline is allowed
+ * @m: mask to fill
+ *
+ * Return: 0 on success, -EINVAL on malformed input or -ERANGE if a node is
+ * not below %I915_NUMA_MAX_NODES.
+ */
+static inline int
+i915_numa_parse_list(const char *s, struct i915_numa_nodemask *m)
+{
+	memset(m, 0, sizeof(*m));
+
+	while (*s && *s != '\n') {
+		__u32 first = 0, last, n;
+
+		if (*s < '0' || *s > '9')
+			return -EINVAL;
+		for (; *s >= '0' && *s <= '9'; s++) {
+			first = first * 10 + (*s - '0');
+			if (first >= I915_NUMA_MAX_NODES)
+				return -ERANGE;
+		}
+
+		last = first;
+		if (*s == '-') {
+			s++;
+			if (*s < '0' || *s > '9')
+				return -EINVAL;
+			for (last = 0; *s >= '0' && *s <= '9'; s++) {
+				last = last * 10 + (*s - '0');
+				if (last >= I915_NUMA_MAX_NODES)
+					return -ERANGE;
+			}
+			if (last < first)
+				return -EINVAL;
+		}
+
+		for (n = first; n <= last; n++)
+			i915_numa_mask_set(m, n);
+
+		if (*s == ',')
+			s++;
+		else if (*s && *s != '\n')
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * struct i915_numa_topology - NUMA view of one card
+ */
+struct i915_numa_topology {
+	/** @online: Online nodes */
+	struct i915_numa_nodemask online;
+
+	/** @device_node: Node of the PCI device of the card, -1 if none */
+	__s32 device_node;
+};
+
+/**
+ * enum i915_numa_class - Allocation class
+ */
+enum i915_numa_class {
+	I915_NUMA_NEAR_DEVICE,
+	I915_NUMA_DEVICE_ONLY,
+	I915_NUMA_SPREAD,
+	I915_NUMA_CPU_LOCAL,
+};
+
+/**
+ * struct i915_numa_policy - Memory policy extension with its nodemask
+ *
+ * &ext.nodemask_ptr points into the struct itself, so fill it where it will
+ * be used and do not copy it afterwards.
+ */
+struct i915_numa_policy {
+	struct prelim_drm_i915_gem_create_ext_memory_policy ext;
+	struct i915_numa_nodemask mask;
+};
+
+/**
+ * i915_numa_policy_fill - Build the memory policy of an allocation class
+ * @p: policy to fill, ready to be linked into a gem_create_ext chain
+ * @topo: topology of the card
+ * @cls: allocation class
+ *
+ * Return: 0 on success, -ENODEV for %I915_NUMA_DEVICE_ONLY when the card has
+ * no node, -EINVAL for an unknown class.
+ */
+static inline int
+i915_numa_policy_fill(struct i915_numa_policy *p,
+		      const struct i915_numa_topology *topo,
+		      enum i915_numa_class cls)
+{
+	memset(p, 0, sizeof(*p));
+	p->ext.base.name = PRELIM_I915_GEM_CREATE_EXT_MEMORY_POLICY;
+
+	switch (cls) {
+	case I915_NUMA_NEAR_DEVICE:
+		if (topo->device_node < 0) {
+			p->ext.mode = I915_GEM_CREATE_MPOL_DEFAULT;
+			return 0;
+		}
+		p->ext.mode = I915_GEM_CREATE_MPOL_PREFERRED;
+		i915_numa_mask_set(&p->mask, topo->device_node);
+		break;
+	case I915_NUMA_DEVICE_ONLY:
+		if (topo->device_node < 0)
+			return -ENODEV;
+		p->ext.mode = I915_GEM_CREATE_MPOL_BIND;
+		i915_numa_mask_set(&p->mask, topo->device_node);
+		break;
+	case I915_NUMA_SPREAD:
+		p->ext.mode = I915_GEM_CREATE_MPOL_INTERLEAVED;
+		p->mask = topo->online;
+		break;
+	case I915_NUMA_CPU_LOCAL:
+		p->ext.mode = I915_GEM_CREATE_MPOL_LOCAL;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+
+	p->ext.nodemask_max = i915_numa_mask_max(&p->mask);
+	p->ext.nodemask_ptr = (__u64)(uintptr_t)p->mask.bits;
+
+	return 0;
+}
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static inline int
+__i915_numa_read(const char *path, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd, err;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	do {
+		len = read(fd, buf, size - 1);
+	} while (len < 0 && errno == EINTR);
+	err = errno;
+	close(fd);
+
+	if (len < 0)
+		return -err;
+	buf[len] = '\0';
+
+	return 0;
+}
+
+/**
+ * i915_numa_topology_read - Discover the NUMA topology of a card
+ * @topo: topology to fill
+ * @root: sysfs mount point, NULL for "/sys"; tests point it at a fake tree
+ * @dev: DRM node name under class/drm, e.g. "card0" or "renderD128"
+ *
+ * Without devices/system/node, as on kernels built without NUMA, node 0 is
+ * the only node. A missing or negative numa_node leaves the card without a
+ * node.
+ *
+ * Return: 0 on success or a negative error code.
+ */
+static inline int
+i915_numa_topology_read(struct i915_numa_topology *topo, const char *root,
+			const char *dev)
+{
+	char path[256], buf[4096];
+	int ret;
+
+	if (!root)
+		root = "/sys";
+
+	memset(topo, 0, sizeof(*topo));
+	topo->device_node = -1;
+
+	snprintf(path, sizeof(path), "%s/devices/system/node/online", root);
+	ret = __i915_numa_read(path, buf, sizeof(buf));
+	if (ret == -ENOENT)
+		i915_numa_mask_set(&topo->online, 0);
+	else if (ret || (ret = i915_numa_parse_list(buf, &topo->online)))
+		return ret;
+
+	snprintf(path, sizeof(path), "%s/class/drm/%s/device/numa_node", root, dev);
+	ret = __i915_numa_read(path, buf, sizeof(buf));
+	if (ret == -ENOENT)
+		return 0;
+	if (ret)
+		return ret;
+
+	if (buf[0] != '-') {
+		__u32 node = 0;
+		char *s;
+
+		for (s = buf; *s >= '0' && *s <= '9'; s++) {
+			node = node * 10 + (*s - '0');
+			if (node >= I915_NUMA_MAX_NODES)
+				return -ERANGE;
+		}
+		if (s == buf || (*s && *s != '\n'))
+			return -EINVAL;
+
+		/* Offline node, let the kernel pick */
+		if (i915_numa_mask_test(&topo->online, node))
+			topo->device_node = node;
+	}
+
+	return 0;
+}
+#endif
+
+#endif /* _I915_NUMA_H_ */
@@ -0,0 +1,414 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_OA_DECODE_H_
+#define _I915_OA_DECODE_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "i915_drm.h"
+
+/**
+ * DOC: OA report decoding
+ *
+ * Reading an i915 perf stream returns a sequence of records, each starting
+ * with a struct drm_i915_perf_record_header whose size covers the header
+ * and its payload. With %DRM_I915_PERF_PROP_SAMPLE_OA the payload of a
+ * %DRM_I915_PERF_RECORD_SAMPLE is one raw OA report.
+ *
+ * The layout of a report depends on its format, and is described here by
+ * a table of segments: runs of counters of the same width stored at a
+ * fixed offset. Decoding walks the records and unpacks every report into
+ * columns, one array per counter with one entry per report, which is the
+ * shape needed to compute deltas and aggregate over a capture. The input
+ * is a plain buffer, so a capture file can be mapped with mmap() and
+ * decoded in place.
+ *
+ * Counters are numbered A first, then B, then C. 40-bit A counters keep
+ * their low 32 bits in the A counter dword and their high byte in the
+ * byte array at offset 160 of the report, indexed by A counter number.
+ *
+ * The prelim 64-bit formats start with a 32 byte header of qwords (report
+ * id, timestamp, context id, GPU ticks), followed by packed counters and
+ * padding up to a multiple of 64 bytes. R counters are reserved and not
+ * decoded.
+ */
+
+#define I915_OA_MAX_SEGMENTS	8
+
+/**
+ * struct i915_oa_segment - Run of counters of one width
+ */
+struct i915_oa_segment {
+	/** @type: Counter width */
+	__u8 type;
+#define I915_OA_U32	1
+#define I915_OA_U40	2
+#define I915_OA_U64	3
+
+	/** @count: Number of counters in the run */
+	__u8 count;
+
+	/** @column: Index of the first counter */
+	__u16 column;
+
+	/** @offset: Byte offset of the first counter, low dword for U40 */
+	__u16 offset;
+
+	/** @high: Byte offset of the high byte of the first U40 counter */
+	__u16 high;
+};
+
+/**
+ * struct i915_oa_layout - Report layout of one OA format
+ */
+struct i915_oa_layout {
+	/** @size: Report size in bytes */
+	__u16 size;
+
+	/** @header_64: Header fields are qwords instead of dwords */
+	__u8 header_64;
+
+	/** @num_segments: Entries in @segments */
+	__u8 num_segments;
+
+	/** @num_a: Number of A counters */
+	__u16 num_a;
+
+	/** @num_counters: Number of A, B and C counters */
+	__u16 num_counters;
+
+	struct i915_oa_segment segments[I915_OA_MAX_SEGMENTS];
+};
+
+/**
+ * i915_oa_layout_get - Look up the layout of an OA format
+ * @format: &enum drm_i915_oa_format or &enum prelim_drm_i915_oa_format
+ *
+ * Return: the layout, or NULL for Haswell formats and unknown formats.
+ */
+static inline const struct i915_oa_layout *
+i915_oa_layout_get(__u32 format)
+{
+	static const struct i915_oa_layout a12 = {
+		64, 0, 1, 12, 12, {
+			{ I915_OA_U32, 12, 0, 16, 0 },
+		},
+	};
+	static const struct i915_oa_layout a12_b8_c8 = {
+		128, 0, 2, 12, 28, {
+			{ I915_OA_U32, 12, 0, 16, 0 },
+			{ I915_OA_U32, 16, 12, 64, 0 },
+		},
+	};
+	static const struct i915_oa_layout a32u40_a4u32_b8_c8 = {
+		256, 0, 3, 36, 52, {
+			{ I915_OA_U40, 32, 0, 16, 160 },
+			{ I915_OA_U32, 4, 32, 144, 0 },
+			{ I915_OA_U32, 16, 36, 192, 0 },
+		},
+	};
+	static const struct i915_oa_layout a24u40_a14u32_b8_c8 = {
+		256, 0, 7, 38, 54, {
+			{ I915_OA_U32, 4, 0, 16, 0 },
+			{ I915_OA_U40, 20, 4, 32, 164 },
+			{ I915_OA_U32, 4, 24, 112, 0 },
+			{ I915_OA_U40, 4, 28, 128, 188 },
+			{ I915_OA_U32, 5, 32, 144, 0 },
+			{ I915_OA_U32, 1, 37, 184, 0 },
+			{ I915_OA_U32, 16, 38, 192, 0 },
+		},
+	};
+	static const struct i915_oa_layout a2u64_b8_c8 = {
+		128, 1, 2, 2, 18, {
+			{ I915_OA_U64, 2, 0, 32, 0 },
+			{ I915_OA_U32, 16, 2, 48, 0 },
+		},
+	};
+	static const struct i915_oa_layout a36u64_b8_c8 = {
+		384, 1, 2, 36, 52, {
+			{ I915_OA_U64, 36, 0, 32, 0 },
+			{ I915_OA_U32, 16, 36, 320, 0 },
+		},
+	};
+	static const struct i915_oa_layout a24u64_b8_c8 = {
+		320, 1, 2, 24, 40, {
+			{ I915_OA_U64, 24, 0, 32, 0 },
+			{ I915_OA_U32, 16, 24, 224, 0 },
+		},
+	};
+	static const struct i915_oa_layout a38u64_r2u64_b8_c8 = {
+		448, 1, 2, 38, 54, {
+			{ I915_OA_U64, 38, 0, 32, 0 },
+			{ I915_OA_U32, 16, 38, 352, 0 },
+		},
+	};
+	static const struct i915_oa_layout a2u64_r2u64_b8_c8 = {
+		128, 1, 2, 2, 18, {
+			{ I915_OA_U64, 2, 0, 32, 0 },
+			{ I915_OA_U32, 16, 2, 64, 0 },
+		},
+	};
+	static const struct i915_oa_layout a22u32_r2u32_b8_c8 = {
+		192, 1, 2, 22, 38, {
+			{ I915_OA_U32, 22, 0, 32, 0 },
+			{ I915_OA_U32, 16, 22, 128, 0 },
+		},
+	};
+	static const struct i915_oa_layout mpec8u64_b8_c8 = {
+		192, 1, 2, 8, 24, {
+			{ I915_OA_U64, 8, 0, 32, 0 },
+			{ I915_OA_U32, 16, 8, 96, 0 },
+		},
+	};
+	static const struct i915_oa_layout mpec8u32_b8_c8 = {
+		128, 1, 2, 8, 24, {
+			{ I915_OA_U32, 8, 0, 32, 0 },
+			{ I915_OA_U32, 16, 8, 64, 0 },
+		},
+	};
+
+	switch (format) {
+	case I915_OA_FORMAT_A12:
+		return &a12;
+	case I915_OA_FORMAT_A12_B8_C8:
+		return &a12_b8_c8;
+	case I915_OA_FORMAT_A32u40_A4u32_B8_C8:
+	case I915_OAR_FORMAT_A32u40_A4u32_B8_C8:
+	case PRELIM_I915_OAR_FORMAT_A32u40_A4u32_B8_C8:
+		return &a32u40_a4u32_b8_c8;
+	case I915_OA_FORMAT_A24u40_A14u32_B8_C8:
+	case PRELIM_I915_OA_FORMAT_A24u40_A14u32_B8_C8:
+		return &a24u40_a14u32_b8_c8;
+	case PRELIM_I915_OAM_FORMAT_A2u64_B8_C8:
+		return &a2u64_b8_c8;
+	case PRELIM_I915_OAR_FORMAT_A36u64_B8_C8:
+		return &a36u64_b8_c8;
+	case PRELIM_I915_OAC_FORMAT_A24u64_B8_C8:
+		return &a24u64_b8_c8;
+	case PRELIM_I915_OA_FORMAT_A38u64_R2u64_B8_C8:
+		return &a38u64_r2u64_b8_c8;
+	case PRELIM_I915_OAM_FORMAT_A2u64_R2u64_B8_C8:
+		return &a2u64_r2u64_b8_c8;
+	case PRELIM_I915_OAC_FORMAT_A22u32_R2u32_B8_C8:
+		return &a22u32_r2u32_b8_c8;
+	case PRELIM_I915_OAM_FORMAT_MPEC8u64_B8_C8:
+		return &mpec8u64_b8_c8;
+	case PRELIM_I915_OAM_FORMAT_MPEC8u32_B8_C8:
+		return &mpec8u32_b8_c8;
+	}
+
+	return NULL;
+}
+
+/**
+ * i915_oa_counter_mask - Wrap mask of one counter
+ * @layout: report layout
+ * @counter: counter index
+ *
+ * Return: the mask to apply to the difference of two readings, 0 if
+ * @counter is out of range.
+ */
+static inline __u64
+i915_oa_counter_mask(const struct i915_oa_layout *layout, __u32 counter)
+{
+	__u32 i;
+
+	for (i = 0; i < layout->num_segments; i++) {
+		const struct i915_oa_segment *s = &layout->segments[i];
+
+		if (counter < s->column || counter >= s->column + s->count)
+			continue;
+
+		return s->type == I915_OA_U32 ? 0xffffffffull :
+		       s->type == I915_OA_U40 ? 0xffffffffffull : ~0ull;
+	}
+
+	return 0;
+}
+
+/**
+ * i915_oa_record_next - Step to the next perf record
+ * @data: buffer returned by read() on the perf fd, or a mapped capture
+ * @len: size of @data
+ * @offset: offset of the record to return, advanced past it
+ *
+ * Return: the record, or NULL at the end of @data or if the remaining
+ * bytes do not hold a complete, well formed record. @offset is left at
+ * the start of such a partial record.
+ */
+static inline const struct drm_i915_perf_record_header *
+i915_oa_record_next(const void *data, size_t len, size_t *offset)
+{
+	const struct drm_i915_perf_record_header *hdr;
+
+	if (*offset > len || len - *offset < sizeof(*hdr))
+		return NULL;
+
+	hdr = (const struct drm_i915_perf_record_header *)((const __u8 *)data + *offset);
+	if (hdr->size < sizeof(*hdr) || hdr->size > len - *offset)
+		return NULL;
+
+	*offset += hdr->size;
+	return hdr;
+}
+
+/**
+ * struct i915_oa_columns - Decoded reports, one array per field
+ *
+ * Counter N of report R is stored at @counters[N * @max + R].
+ */
+struct i915_oa_columns {
+	/** @timestamp: Report timestamps */
+	__u64 *timestamp;
+
+	/** @ticks: GPU clock ticks */
+	__u64 *ticks;
+
+	/** @ctx_id: Context ids, may be NULL */
+	__u32 *ctx_id;
+
+	/** @counters: &i915_oa_layout.num_counters arrays of @max entries */
+	__u64 *counters;
+
+	/** @max: Capacity, in reports */
+	__u32 max;
+
+	/** @count: Number of decoded reports */
+	__u32 count;
+};
+
+static inline __u32
+__i915_oa_u32(const __u8 *p)
+{
+	__u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline __u64
+__i915_oa_u64(const __u8 *p)
+{
+	__u64 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/**
+ * i915_oa_report_decode - Unpack one report into the columns
+ * @layout: report layout
+ * @report: raw report, @layout->size bytes
+ * @cols: destination, must have room for one more report
+ */
+static inline void
+i915_oa_report_decode(const struct i915_oa_layout *layout, const void *report,
+		      struct i915_oa_columns *cols)
+{
+	const __u8 *r = (const __u8 *)report;
+	__u64 *out = cols->counters + cols->count;
+	__u32 i, j;
+
+	if (layout->header_64) {
+		cols->timestamp[cols->count] = __i915_oa_u64(r + 8);
+		cols->ticks[cols->count] = __i915_oa_u64(r + 24);
+		if (cols->ctx_id)
+			cols->ctx_id[cols->count] = (__u32)__i915_oa_u64(r + 16);
+	} else {
+		cols->timestamp[cols->count] = __i915_oa_u32(r + 4);
+		cols->ticks[cols->count] = __i915_oa_u32(r + 12);
+		if (cols->ctx_id)
+			cols->ctx_id[cols->count] = __i915_oa_u32(r + 8);
+	}
+
+	for (i = 0; i < layout->num_segments; i++) {
+		const struct i915_oa_segment *s = &layout->segments[i];
+		__u64 *col = out + (size_t)s->column * cols->max;
+		const __u8 *p = r + s->offset;
+
+		switch (s->type) {
+		case I915_OA_U32:
+			for (j = 0; j < s->count; j++)
+				col[(size_t)j * cols->max] = __i915_oa_u32(p + 4 * j);
+			break;
+		case I915_OA_U40:
+			for (j = 0; j < s->count; j++)
+				col[(size_t)j * cols->max] = __i915_oa_u32(p + 4 * j) |
+							     (__u64)r[s->high + j] << 32;
+			break;
+		case I915_OA_U64:
+			for (j = 0; j < s->count; j++)
+				col[(size_t)j * cols->max] = __i915_oa_u64(p + 8 * j);
+			break;
+		}
+	}
+
+	cols->count++;
+}
+
+/**
+ * i915_oa_decode - Decode the samples of a perf stream
+ * @layout: layout of the format the stream was opened with
+ * @data: records read from the stream
+ * @len: size of @data
+ * @offset: where to start, advanced past the consumed records
+ * @cols: destination, decoding stops when it is full
+ *
+ * Records other than %DRM_I915_PERF_RECORD_SAMPLE are skipped; a sample
+ * must hold exactly one report of @layout. Call again with the same
+ * @offset once @cols has been drained, or after appending the rest of a
+ * partial record to @data.
+ *
+ * Return: the number of reports decoded, or -EINVAL if a sample does not
+ * match @layout, with @offset left at that sample.
+ */
+static inline int
+i915_oa_decode(const struct i915_oa_layout *layout, const void *data,
+	       size_t len, size_t *offset, struct i915_oa_columns *cols)
+{
+	const struct drm_i915_perf_record_header *hdr;
+	__u32 first = cols->count;
+	size_t pos;
+
+	while (cols->count < cols->max) {
+		pos = *offset;
+		hdr = i915_oa_record_next(data, len, offset);
+		if (!hdr)
+			break;
+
+		if (hdr->type != DRM_I915_PERF_RECORD_SAMPLE)
+			continue;
+
+		if (hdr->size != sizeof(*hdr) + layout->size) {
+			*offset = pos;
+			return -EINVAL;
+		}
+
+		i915_oa_report_decode(layout, hdr + 1, cols);
+	}
+
+	return cols->count - first;
+}
+
+/**
+ * i915_oa_deltas - Wrap-safe differences of consecutive readings
+ * @col: one counter column
+ * @count: number of readings in @col
+ * @mask: i915_oa_counter_mask() of the counter
+ * @delta: receives @count - 1 differences, may alias @col
+ */
+static inline void
+i915_oa_deltas(const __u64 *col, __u32 count, __u64 mask, __u64 *delta)
+{
+	__u32 i;
+
+	for (i = 1; i < count; i++)
+		delta[i - 1] = (col[i] - col[i - 1]) & mask;
+}
+
+#endif /* _I915_OA_DECODE_H_ */
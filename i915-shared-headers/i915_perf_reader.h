@@ -0,0 +1,376 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_PERF_READER_H_
+#define _I915_PERF_READER_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "i915_drm.h"
+#include "i915_oa_decode.h"
+
+/**
+ * DOC: Perf stream reader
+ *
+ * Reading the perf fd from the threads that consume the samples makes them
+ * stall whenever the OA buffer is drained. struct i915_perf_reader is
+ * meant to be driven by one dedicated thread instead:
+ *
+ *   .. code:: c
+ *
+ *      struct pollfd pfd = { .fd = perf_fd, .events = POLLIN };
+ *
+ *      while (running) {
+ *              poll(&pfd, 1, 100);
+ *              i915_perf_reader_pump(&reader, i915_perf_read_fd, &perf_fd);
+ *      }
+ *
+ * Each pump reads as many records as fit in the scratch buffer, counts
+ * them by type in &i915_perf_reader.stats and pushes the samples into a
+ * single producer, single consumer ring. Consumers on another thread pop
+ * whole records from the ring without locks. A sample that does not fit in
+ * the ring is dropped and counted, so a slow consumer never blocks the
+ * reader.
+ *
+ * Open the stream with i915_perf_batch_props() appended to the properties
+ * so the kernel only wakes the reader once a batch of reports is ready.
+ * Records cut by a short read, as happens when the fd is a pipe standing
+ * in for the perf fd, are carried over to the next pump.
+ */
+
+/**
+ * i915_perf_batch_props - Append the properties that batch reads
+ * @props: property array, with room for 2 more (id, value) pairs
+ * @num_props: number of pairs already in @props
+ * @poll_period_ns: %DRM_I915_PERF_PROP_POLL_OA_PERIOD, 0 to omit; at least
+ *		    100 microseconds, needs perf revision 5
+ * @notify_num_reports: %PRELIM_DRM_I915_PERF_PROP_OA_NOTIFY_NUM_REPORTS,
+ *			0 to omit; needs perf revision 1008
+ *
+ * Return: the new number of pairs, for
+ * &drm_i915_perf_open_param.num_properties.
+ */
+static inline __u32
+i915_perf_batch_props(__u64 *props, __u32 num_props, __u64 poll_period_ns,
+		      __u32 notify_num_reports)
+{
+	if (poll_period_ns) {
+		props[2 * num_props] = DRM_I915_PERF_PROP_POLL_OA_PERIOD;
+		props[2 * num_props + 1] = poll_period_ns;
+		num_props++;
+	}
+
+	if (notify_num_reports) {
+		props[2 * num_props] = PRELIM_DRM_I915_PERF_PROP_OA_NOTIFY_NUM_REPORTS;
+		props[2 * num_props + 1] = notify_num_reports;
+		num_props++;
+	}
+
+	return num_props;
+}
+
+/**
+ * struct i915_perf_stats - Record counts of a stream
+ *
+ * Written by the reader thread only; read them with
+ * i915_perf_stats_snapshot() from other threads.
+ */
+struct i915_perf_stats {
+	/** @samples: %DRM_I915_PERF_RECORD_SAMPLE records */
+	__u64 samples;
+
+	/** @report_lost: %DRM_I915_PERF_RECORD_OA_REPORT_LOST records */
+	__u64 report_lost;
+
+	/** @buffer_lost: %DRM_I915_PERF_RECORD_OA_BUFFER_LOST records */
+	__u64 buffer_lost;
+
+	/** @mmio_trg_q_full: %PRELIM_DRM_I915_PERF_RECORD_OA_MMIO_TRG_Q_FULL records */
+	__u64 mmio_trg_q_full;
+
+	/** @unknown: Records of any other type */
+	__u64 unknown;
+
+	/** @ring_dropped: Samples dropped because the ring was full */
+	__u64 ring_dropped;
+
+	/** @bytes: Bytes read from the stream */
+	__u64 bytes;
+};
+
+static inline void
+__i915_perf_stat_add(__u64 *stat, __u64 n)
+{
+	__atomic_store_n(stat, *stat + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * i915_perf_stats_account - Count one record
+ * @stats: counters to update
+ * @hdr: record
+ */
+static inline void
+i915_perf_stats_account(struct i915_perf_stats *stats,
+			const struct drm_i915_perf_record_header *hdr)
+{
+	switch (hdr->type) {
+	case DRM_I915_PERF_RECORD_SAMPLE:
+		__i915_perf_stat_add(&stats->samples, 1);
+		break;
+	case DRM_I915_PERF_RECORD_OA_REPORT_LOST:
+		__i915_perf_stat_add(&stats->report_lost, 1);
+		break;
+	case DRM_I915_PERF_RECORD_OA_BUFFER_LOST:
+		__i915_perf_stat_add(&stats->buffer_lost, 1);
+		break;
+	case PRELIM_DRM_I915_PERF_RECORD_OA_MMIO_TRG_Q_FULL:
+		__i915_perf_stat_add(&stats->mmio_trg_q_full, 1);
+		break;
+	default:
+		__i915_perf_stat_add(&stats->unknown, 1);
+		break;
+	}
+}
+
+/**
+ * i915_perf_stats_snapshot - Read the counters from any thread
+ * @stats: counters updated by the reader
+ * @out: copy
+ */
+static inline void
+i915_perf_stats_snapshot(const struct i915_perf_stats *stats,
+			 struct i915_perf_stats *out)
+{
+	out->samples = __atomic_load_n(&stats->samples, __ATOMIC_RELAXED);
+	out->report_lost = __atomic_load_n(&stats->report_lost, __ATOMIC_RELAXED);
+	out->buffer_lost = __atomic_load_n(&stats->buffer_lost, __ATOMIC_RELAXED);
+	out->mmio_trg_q_full = __atomic_load_n(&stats->mmio_trg_q_full, __ATOMIC_RELAXED);
+	out->unknown = __atomic_load_n(&stats->unknown, __ATOMIC_RELAXED);
+	out->ring_dropped = __atomic_load_n(&stats->ring_dropped, __ATOMIC_RELAXED);
+	out->bytes = __atomic_load_n(&stats->bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * struct i915_perf_ring - Single producer, single consumer record ring
+ *
+ * @head and @tail run freely and are reduced modulo @size on access. They
+ * live on separate cache lines so the two threads do not contend.
+ */
+struct i915_perf_ring {
+	__u8 *buf;
+	__u32 size;
+
+	/* Written by the producer */
+	__u32 head __attribute__((aligned(64)));
+
+	/* Written by the consumer */
+	__u32 tail __attribute__((aligned(64)));
+};
+
+/**
+ * i915_perf_ring_init - Set up a ring over caller-owned memory
+ * @ring: ring to initialise
+ * @buf: storage
+ * @size: size of @buf, a power of two of at most 2GiB
+ *
+ * Return: 0 on success, -EINVAL if @size is not a power of two.
+ */
+static inline int
+i915_perf_ring_init(struct i915_perf_ring *ring, void *buf, __u32 size)
+{
+	if (!size || size & (size - 1) || size > 1u << 31)
+		return -EINVAL;
+
+	ring->buf = (__u8 *)buf;
+	ring->size = size;
+	ring->head = 0;
+	ring->tail = 0;
+	return 0;
+}
+
+static inline void
+__i915_perf_ring_write(struct i915_perf_ring *ring, __u32 pos,
+		       const void *src, __u32 len)
+{
+	__u32 off = pos & (ring->size - 1);
+	__u32 first = ring->size - off < len ? ring->size - off : len;
+
+	memcpy(ring->buf + off, src, first);
+	memcpy(ring->buf, (const __u8 *)src + first, len - first);
+}
+
+static inline void
+__i915_perf_ring_read(const struct i915_perf_ring *ring, __u32 pos,
+		      void *dst, __u32 len)
+{
+	__u32 off = pos & (ring->size - 1);
+	__u32 first = ring->size - off < len ? ring->size - off : len;
+
+	memcpy(dst, ring->buf + off, first);
+	memcpy((__u8 *)dst + first, ring->buf, len - first);
+}
+
+/**
+ * i915_perf_ring_push - Append a record, producer side
+ * @ring: ring
+ * @hdr: record, &drm_i915_perf_record_header.size bytes
+ *
+ * Return: 0 on success, -ENOSPC if the ring does not have room for it.
+ */
+static inline int
+i915_perf_ring_push(struct i915_perf_ring *ring,
+		    const struct drm_i915_perf_record_header *hdr)
+{
+	__u32 head = ring->head;
+	__u32 tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (hdr->size > ring->size - (head - tail))
+		return -ENOSPC;
+
+	__i915_perf_ring_write(ring, head, hdr, hdr->size);
+	__atomic_store_n(&ring->head, head + hdr->size, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * i915_perf_ring_pop - Remove the oldest record, consumer side
+ * @ring: ring
+ * @buf: destination, receives the record including its header
+ * @len: size of @buf
+ *
+ * Return: the size of the record, 0 if the ring is empty, or -EMSGSIZE if
+ * it does not fit in @buf, in which case it stays in the ring.
+ */
+static inline int
+i915_perf_ring_pop(struct i915_perf_ring *ring, void *buf, size_t len)
+{
+	struct drm_i915_perf_record_header hdr;
+	__u32 tail = ring->tail;
+	__u32 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return 0;
+
+	__i915_perf_ring_read(ring, tail, &hdr, sizeof(hdr));
+	if (hdr.size > len)
+		return -EMSGSIZE;
+
+	__i915_perf_ring_read(ring, tail, buf, hdr.size);
+	__atomic_store_n(&ring->tail, tail + hdr.size, __ATOMIC_RELEASE);
+	return hdr.size;
+}
+
+/**
+ * typedef i915_perf_read_fn - Read from a perf stream
+ * @ctx: opaque pointer passed to i915_perf_reader_pump()
+ * @buf: destination
+ * @len: size of @buf
+ *
+ * Return: the number of bytes read, 0 at end of stream, or a negative
+ * error code; -EAGAIN when a non-blocking stream has no data.
+ */
+typedef long (*i915_perf_read_fn)(void *ctx, void *buf, size_t len);
+
+/**
+ * struct i915_perf_reader - State of the reader thread
+ */
+struct i915_perf_reader {
+	/** @ring: Where samples are pushed */
+	struct i915_perf_ring *ring;
+
+	/** @stats: Record counts */
+	struct i915_perf_stats stats;
+
+	/** @scratch: Read buffer, larger than the largest record */
+	__u8 *scratch;
+
+	/** @scratch_size: Size of @scratch */
+	size_t scratch_size;
+
+	/** @carry: Bytes of a partial record kept at the start of @scratch */
+	size_t carry;
+};
+
+static inline void
+i915_perf_reader_init(struct i915_perf_reader *reader,
+		      struct i915_perf_ring *ring, void *scratch,
+		      size_t scratch_size)
+{
+	memset(reader, 0, sizeof(*reader));
+	reader->ring = ring;
+	reader->scratch = (__u8 *)scratch;
+	reader->scratch_size = scratch_size;
+}
+
+/**
+ * i915_perf_reader_pump - Read once and dispatch the records
+ * @reader: reader
+ * @fn: read callback
+ * @ctx: passed to @fn
+ *
+ * Return: the number of complete records handled, -EMSGSIZE if a record
+ * does not fit in the scratch buffer, or the negative error code of @fn,
+ * e.g. -EAGAIN.
+ */
+static inline int
+i915_perf_reader_pump(struct i915_perf_reader *reader, i915_perf_read_fn fn,
+		      void *ctx)
+{
+	const struct drm_i915_perf_record_header *hdr;
+	size_t len, offset = 0;
+	long ret;
+	int count = 0;
+
+	if (reader->carry == reader->scratch_size)
+		return -EMSGSIZE;
+
+	ret = fn(ctx, reader->scratch + reader->carry,
+		 reader->scratch_size - reader->carry);
+	if (ret <= 0)
+		return (int)ret;
+
+	__i915_perf_stat_add(&reader->stats.bytes, ret);
+	len = reader->carry + ret;
+
+	while ((hdr = i915_oa_record_next(reader->scratch, len, &offset))) {
+		i915_perf_stats_account(&reader->stats, hdr);
+		if (hdr->type == DRM_I915_PERF_RECORD_SAMPLE &&
+		    i915_perf_ring_push(reader->ring, hdr))
+			__i915_perf_stat_add(&reader->stats.ring_dropped, 1);
+		count++;
+	}
+
+	reader->carry = len - offset;
+	memmove(reader->scratch, reader->scratch + offset, reader->carry);
+
+	return count;
+}
+
+#ifdef __linux__
+#include <unistd.h>
+
+/**
+ * i915_perf_read_fd - &i915_perf_read_fn backed by a perf fd
+ * @ctx: pointer to an int holding the fd
+ * @buf: destination
+ * @len: size of @buf
+ */
+static inline long
+i915_perf_read_fd(void *ctx, void *buf, size_t len)
+{
+	int fd = *(int *)ctx;
+	ssize_t ret;
+
+	do {
+		ret = read(fd, buf, len);
+	} while (ret == -1 && errno == EINTR);
+
+	return ret < 0 ? -errno : ret;
+}
+#endif
+
+#endif /* _I915_PERF_READER_H_ */
@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_PLACEMENT_H_
+#define _I915_PLACEMENT_H_
+
+#include <errno.h>
+#include <string.h>
+
+#include "i915_drm.h"
+
+/**
+ * DOC: Distance-aware memory region placement
+ *
+ * %PRELIM_DRM_I915_QUERY_DISTANCE_INFO reports how far each engine is from
+ * each memory region, and %PRELIM_DRM_I915_QUERY_MEMORY_REGIONS reports how
+ * much of each region is still free. The helpers below combine the two to
+ * build the placement list passed with %PRELIM_I915_PARAM_MEMORY_REGIONS in
+ * a &prelim_drm_i915_gem_create_ext_setparam extension.
+ *
+ * Buffers are placed one at a time, in the order given, on the nearest
+ * region reachable from their engine that still has room. The remaining
+ * reachable regions follow in increasing distance so the kernel can fall
+ * back to them. Ties are broken by region order in the query result, so the
+ * plan only depends on its inputs.
+ *
+ * This is a greedy heuristic, not a minimum total distance assignment.
+ * When every nearest region has room for all of its buffers the two are
+ * the same. Once free space runs out, an early buffer can take the last
+ * room in a region that a later buffer needed more, and the total distance
+ * ends up higher than it could be. Finding the optimum under capacity
+ * limits is the generalised assignment problem, which is NP-hard, so the
+ * planner does not attempt it. Placing large buffers first usually gets
+ * closer to it.
+ *
+ * The planner only tracks its own reservations against the free space
+ * reported at query time; it does not allocate anything.
+ */
+
+#define I915_PLACEMENT_MAX_REGIONS	16
+
+/**
+ * struct i915_placement_buffer - One buffer to place
+ */
+struct i915_placement_buffer {
+	/** @engine: Engine expected to access the buffer the most */
+	struct i915_engine_class_instance engine;
+
+	/** @size: Size of the buffer in bytes */
+	__u64 size;
+
+	/** @flags: Placement hints */
+	__u32 flags;
+/* Append system memory to the list even if it has no distance entry */
+#define I915_PLACEMENT_SMEM_FALLBACK	(1 << 0)
+/* Only consider device memory */
+#define I915_PLACEMENT_LMEM_ONLY	(1 << 1)
+
+	/** @num_placements: Output, number of entries in @placements */
+	__u32 num_placements;
+
+	/** @distance: Output, distance to the first placement */
+	__s32 distance;
+
+	/** @placements: Output, regions in priority order */
+	struct prelim_drm_i915_gem_memory_class_instance placements[I915_PLACEMENT_MAX_REGIONS];
+};
+
+/**
+ * struct i915_placement_plan - Planner state
+ */
+struct i915_placement_plan {
+	/** @regions: Regions copied from the memory region query */
+	struct prelim_drm_i915_gem_memory_class_instance regions[I915_PLACEMENT_MAX_REGIONS];
+
+	/** @free: Bytes not yet planned in each region, ~0 if unknown */
+	__u64 free[I915_PLACEMENT_MAX_REGIONS];
+
+	/** @num_regions: Number of valid entries in @regions */
+	__u32 num_regions;
+
+	/** @num_distances: Number of entries in @distances */
+	__u32 num_distances;
+
+	/** @distances: Filled %PRELIM_DRM_I915_QUERY_DISTANCE_INFO entries */
+	const struct prelim_drm_i915_query_distance_info *distances;
+};
+
+/**
+ * i915_placement_init - Prepare a plan from query results
+ * @plan: plan to initialise
+ * @regions: %PRELIM_DRM_I915_QUERY_MEMORY_REGIONS result
+ * @distances: %PRELIM_DRM_I915_QUERY_DISTANCE_INFO results, must stay valid
+ *	       while the plan is used
+ * @num_distances: number of entries in @distances
+ *
+ * Return: 0 on success, -E2BIG if there are more than
+ * %I915_PLACEMENT_MAX_REGIONS regions.
+ */
+static inline int
+i915_placement_init(struct i915_placement_plan *plan,
+		    const struct prelim_drm_i915_query_memory_regions *regions,
+		    const struct prelim_drm_i915_query_distance_info *distances,
+		    __u32 num_distances)
+{
+	__u32 i;
+
+	if (regions->num_regions > I915_PLACEMENT_MAX_REGIONS)
+		return -E2BIG;
+
+	memset(plan, 0, sizeof(*plan));
+	plan->num_regions = regions->num_regions;
+	for (i = 0; i < regions->num_regions; i++) {
+		plan->regions[i] = regions->regions[i].region;
+		plan->free[i] = regions->regions[i].unallocated_size;
+	}
+	plan->distances = distances;
+	plan->num_distances = num_distances;
+
+	return 0;
+}
+
+/**
+ * i915_placement_distance - Distance between an engine and a planned region
+ * @plan: initialised plan
+ * @engine: engine to look up
+ * @region: index into &i915_placement_plan.regions
+ *
+ * Return: the reported distance, or -1 if it is unknown or unreachable.
+ */
+static inline __s32
+i915_placement_distance(const struct i915_placement_plan *plan,
+			const struct i915_engine_class_instance *engine,
+			__u32 region)
+{
+	const struct prelim_drm_i915_gem_memory_class_instance *r =
+		&plan->regions[region];
+	__u32 i;
+
+	for (i = 0; i < plan->num_distances; i++) {
+		const struct prelim_drm_i915_query_distance_info *d =
+			&plan->distances[i];
+
+		if (d->engine.engine_class == engine->engine_class &&
+		    d->engine.engine_instance == engine->engine_instance &&
+		    d->region.memory_class == r->memory_class &&
+		    d->region.memory_instance == r->memory_instance)
+			return d->distance;
+	}
+
+	return -1;
+}
+
+/**
+ * i915_placement_place - Choose the placement list of one buffer
+ * @plan: initialised plan
+ * @buf: buffer to place, outputs are filled in
+ *
+ * On success the size of @buf is reserved in the first region of its list.
+ *
+ * Return: 0 on success, -ENOSPC if no reachable region has room.
+ */
+static inline int
+i915_placement_place(struct i915_placement_plan *plan,
+		     struct i915_placement_buffer *buf)
+{
+	__s32 dist[I915_PLACEMENT_MAX_REGIONS];
+	__u32 order[I915_PLACEMENT_MAX_REGIONS];
+	__u32 i, j, n = 0;
+	int best = -1;
+
+	for (i = 0; i < plan->num_regions; i++) {
+		int smem = plan->regions[i].memory_class == PRELIM_I915_MEMORY_CLASS_SYSTEM;
+
+		if (smem && buf->flags & I915_PLACEMENT_LMEM_ONLY)
+			continue;
+
+		dist[i] = i915_placement_distance(plan, &buf->engine, i);
+		if (dist[i] < 0 && !(smem && buf->flags & I915_PLACEMENT_SMEM_FALLBACK))
+			continue;
+
+		/* Unknown distances sort last, in region order */
+		for (j = n; j > 0 && (__u32)dist[order[j - 1]] > (__u32)dist[i]; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+		n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (plan->free[order[i]] >= buf->size) {
+			best = order[i];
+			break;
+		}
+	}
+	if (best < 0)
+		return -ENOSPC;
+
+	if (plan->free[best] != ~0ull)
+		plan->free[best] -= buf->size;
+
+	buf->distance = dist[best];
+	buf->placements[0] = plan->regions[best];
+	buf->num_placements = 1;
+	for (i = 0; i < n; i++) {
+		if (order[i] != (__u32)best)
+			buf->placements[buf->num_placements++] = plan->regions[order[i]];
+	}
+
+	return 0;
+}
+
+#endif /* _I915_PLACEMENT_H_ */
@@ -0,0 +1,345 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_QUERY_BATCH_H_
+#define _I915_QUERY_BATCH_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "i915_drm.h"
+
+/**
+ * DOC: Batched i915 queries
+ *
+ * struct drm_i915_query takes an array of items, so any mix of upstream and
+ * PRELIM_DRM_I915_QUERY_* items can be sized and filled with two ioctls in
+ * total instead of two per item:
+ *
+ *   .. code:: c
+ *
+ *      struct drm_i915_query_item items[8];
+ *      struct i915_query_batch batch;
+ *      int topo, hwcfg;
+ *
+ *      i915_query_batch_init(&batch, items, 8);
+ *      topo = i915_query_batch_add(&batch, DRM_I915_QUERY_TOPOLOGY_INFO, 0);
+ *      hwcfg = i915_query_batch_add(&batch, DRM_I915_QUERY_HWCONFIG_BLOB, 0);
+ *
+ *      i915_query_batch_probe(&batch, i915_query_batch_ioctl, &fd);
+ *      arena = aligned_alloc(8, i915_query_batch_arena_size(&batch));
+ *      i915_query_batch_assign(&batch, arena);
+ *      i915_query_batch_fill(&batch, i915_query_batch_ioctl, &fd);
+ *
+ *      topo_info = i915_query_batch_result(&batch, topo, &len);
+ *
+ * All results share the single caller-owned arena, each 8 byte aligned, and
+ * i915_query_batch_result() returns pointers into it without copying.
+ *
+ * Some items read their input from the result buffer, e.g.
+ * %PRELIM_DRM_I915_QUERY_DISTANCE_INFO, %PRELIM_DRM_I915_QUERY_CS_CYCLES
+ * or %DRM_I915_QUERY_PERF_CONFIG with a UUID or id. Give the batch a
+ * caller-owned input table with i915_query_batch_set_inputs() and add
+ * those items with i915_query_batch_add_input(); i915_query_batch_assign()
+ * copies the input into the item's arena slot before the fill. The
+ * geometry and compute subslice queries take their engine in @flags only
+ * and need no input.
+ *
+ * The ioctl is issued through a callback so that tests can run against a
+ * fake device; i915_query_batch_ioctl() is the real one.
+ */
+
+/**
+ * typedef i915_query_ioctl_fn - Issue %DRM_IOCTL_I915_QUERY
+ * @ctx: opaque pointer passed through by the batch helpers
+ * @query: query to submit
+ *
+ * Return: 0 on success or a negative error code.
+ */
+typedef int (*i915_query_ioctl_fn)(void *ctx, struct drm_i915_query *query);
+
+/**
+ * struct i915_query_batch - A set of query items submitted together
+ */
+struct i915_query_batch {
+	/** @items: Caller-owned item storage */
+	struct drm_i915_query_item *items;
+
+	/** @num_items: Number of items added so far */
+	__u32 num_items;
+
+	/** @max_items: Capacity of @items */
+	__u32 max_items;
+
+	/** @inputs: Optional caller-owned input table of @max_items entries */
+	struct i915_query_batch_input *inputs;
+};
+
+/**
+ * struct i915_query_batch_input - Input payload of one item
+ */
+struct i915_query_batch_input {
+	/** @data: Copied to the start of the result buffer, or NULL */
+	const void *data;
+
+	/** @size: Size of @data in bytes */
+	__u32 size;
+};
+
+#define I915_QUERY_BATCH_ALIGN(x)	(((x) + 7) & ~(__u64)7)
+
+static inline void
+i915_query_batch_init(struct i915_query_batch *batch,
+		      struct drm_i915_query_item *items, __u32 max_items)
+{
+	batch->items = items;
+	batch->num_items = 0;
+	batch->max_items = max_items;
+	batch->inputs = NULL;
+}
+
+/**
+ * i915_query_batch_set_inputs - Enable items with an input payload
+ * @batch: batch, before any item is added
+ * @inputs: table of &i915_query_batch.max_items entries
+ */
+static inline void
+i915_query_batch_set_inputs(struct i915_query_batch *batch,
+			    struct i915_query_batch_input *inputs)
+{
+	batch->inputs = inputs;
+}
+
+/**
+ * i915_query_batch_add - Append an item to the batch
+ * @batch: batch to extend
+ * @query_id: upstream or PRELIM_DRM_I915_QUERY_* id
+ * @flags: &drm_i915_query_item.flags for @query_id
+ *
+ * Return: index of the item, or -ENOSPC if the batch is full.
+ */
+static inline int
+i915_query_batch_add(struct i915_query_batch *batch, __u64 query_id,
+		     __u32 flags)
+{
+	struct drm_i915_query_item *item;
+
+	if (batch->num_items == batch->max_items)
+		return -ENOSPC;
+
+	item = &batch->items[batch->num_items];
+	memset(item, 0, sizeof(*item));
+	item->query_id = query_id;
+	item->flags = flags;
+	if (batch->inputs) {
+		batch->inputs[batch->num_items].data = NULL;
+		batch->inputs[batch->num_items].size = 0;
+	}
+
+	return batch->num_items++;
+}
+
+/**
+ * i915_query_batch_add_input - Append an item that reads an input payload
+ * @batch: batch with an input table
+ * @query_id: upstream or PRELIM_DRM_I915_QUERY_* id
+ * @flags: &drm_i915_query_item.flags for @query_id
+ * @data: input payload, must stay valid until i915_query_batch_assign()
+ * @size: size of @data in bytes
+ *
+ * Return: index of the item, -ENOSPC if the batch is full or -EINVAL if
+ * the batch has no input table.
+ */
+static inline int
+i915_query_batch_add_input(struct i915_query_batch *batch, __u64 query_id,
+			   __u32 flags, const void *data, __u32 size)
+{
+	int index;
+
+	if (!batch->inputs)
+		return -EINVAL;
+
+	index = i915_query_batch_add(batch, query_id, flags);
+	if (index < 0)
+		return index;
+
+	batch->inputs[index].data = data;
+	batch->inputs[index].size = size;
+
+	return index;
+}
+
+/**
+ * i915_query_batch_submit - Issue one ioctl for every item of the batch
+ * @batch: batch to submit
+ * @fn: ioctl callback
+ * @ctx: passed to @fn
+ *
+ * The items are submitted as they are; i915_query_batch_probe() and
+ * i915_query_batch_fill() prepare them first.
+ *
+ * Return: the result of @fn. Errors of individual items are reported in
+ * their &drm_i915_query_item.length.
+ */
+static inline int
+i915_query_batch_submit(struct i915_query_batch *batch,
+			i915_query_ioctl_fn fn, void *ctx)
+{
+	struct drm_i915_query query;
+
+	memset(&query, 0, sizeof(query));
+	query.num_items = batch->num_items;
+	query.items_ptr = (uintptr_t)batch->items;
+
+	return fn(ctx, &query);
+}
+
+/**
+ * i915_query_batch_probe - Ask the kernel for the size of every item
+ * @batch: batch to size
+ * @fn: ioctl callback
+ * @ctx: passed to @fn
+ *
+ * Issues a single ioctl. Afterwards each &drm_i915_query_item.length holds
+ * either the size of the result or a negative error code for that item.
+ */
+static inline int
+i915_query_batch_probe(struct i915_query_batch *batch,
+		       i915_query_ioctl_fn fn, void *ctx)
+{
+	__u32 i;
+
+	for (i = 0; i < batch->num_items; i++) {
+		batch->items[i].length = 0;
+		batch->items[i].data_ptr = 0;
+	}
+
+	return i915_query_batch_submit(batch, fn, ctx);
+}
+
+/**
+ * i915_query_batch_arena_size - Bytes needed to hold every probed result
+ * @batch: probed batch
+ */
+static inline __u64
+i915_query_batch_arena_size(const struct i915_query_batch *batch)
+{
+	__u64 size = 0;
+	__u32 i;
+
+	for (i = 0; i < batch->num_items; i++) {
+		if (batch->items[i].length > 0)
+			size += I915_QUERY_BATCH_ALIGN(batch->items[i].length);
+	}
+
+	return size;
+}
+
+/**
+ * i915_query_batch_assign - Point every probed item into one arena
+ * @batch: probed batch
+ * @arena: 8 byte aligned buffer of i915_query_batch_arena_size() bytes
+ *
+ * Items that failed to probe keep their error and a zero data pointer, so
+ * the kernel reports the same error again during the fill. Input payloads
+ * are copied to the start of their slot and the rest of it is zeroed.
+ *
+ * Return: 0 on success, -EINVAL if an input is larger than the size the
+ * kernel reported for its item; the arena is then only partly assigned.
+ */
+static inline int
+i915_query_batch_assign(struct i915_query_batch *batch, void *arena)
+{
+	__u8 *ptr = (__u8 *)arena;
+	__u32 i;
+
+	for (i = 0; i < batch->num_items; i++) {
+		struct drm_i915_query_item *item = &batch->items[i];
+		const struct i915_query_batch_input *in =
+			batch->inputs ? &batch->inputs[i] : NULL;
+
+		if (item->length <= 0)
+			continue;
+
+		if (in && in->data) {
+			if (in->size > (__u32)item->length)
+				return -EINVAL;
+			memcpy(ptr, in->data, in->size);
+			memset(ptr + in->size, 0, item->length - in->size);
+		}
+
+		item->data_ptr = (uintptr_t)ptr;
+		ptr += I915_QUERY_BATCH_ALIGN(item->length);
+	}
+
+	return 0;
+}
+
+/**
+ * i915_query_batch_fill - Let the kernel write every result into the arena
+ * @batch: batch after i915_query_batch_assign()
+ * @fn: ioctl callback
+ * @ctx: passed to @fn
+ */
+static inline int
+i915_query_batch_fill(struct i915_query_batch *batch,
+		      i915_query_ioctl_fn fn, void *ctx)
+{
+	return i915_query_batch_submit(batch, fn, ctx);
+}
+
+/**
+ * i915_query_batch_result - Access the result of one item
+ * @batch: filled batch
+ * @index: value returned by i915_query_batch_add()
+ * @length: returns the size of the result in bytes, or the error code
+ *
+ * Return: pointer into the arena, or NULL if the item failed. An @index
+ * outside of the batch returns NULL with @length set to -EINVAL.
+ */
+static inline const void *
+i915_query_batch_result(const struct i915_query_batch *batch, int index,
+			__s32 *length)
+{
+	const struct drm_i915_query_item *item;
+
+	if (index < 0 || (__u32)index >= batch->num_items) {
+		*length = -EINVAL;
+		return NULL;
+	}
+
+	item = &batch->items[index];
+	*length = item->length;
+	if (item->length <= 0 || !item->data_ptr)
+		return NULL;
+
+	return (const void *)(uintptr_t)item->data_ptr;
+}
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+
+/**
+ * i915_query_batch_ioctl - &i915_query_ioctl_fn backed by a DRM fd
+ * @ctx: pointer to an int holding the DRM fd
+ * @query: query to submit
+ */
+static inline int
+i915_query_batch_ioctl(void *ctx, struct drm_i915_query *query)
+{
+	int fd = *(int *)ctx;
+	int ret;
+
+	do {
+		ret = ioctl(fd, DRM_IOCTL_I915_QUERY, query);
+	} while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+
+	return ret ? -errno : 0;
+}
+#endif
+
+#endif /* _I915_QUERY_BATCH_H_ */
@@ -0,0 +1,343 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_QUERY_CACHE_H_
+#define _I915_QUERY_CACHE_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "i915_drm.h"
+
+/**
+ * DOC: i915 query cache file
+ *
+ * Most results of %DRM_IOCTL_I915_QUERY describe fixed properties of one
+ * card under one kernel, so userspace may persist them and skip the
+ * queries on the next start. This header describes a file layout that can
+ * be mmap()ed and used in place, without parsing:
+ *
+ *   .. code:: c
+ *
+ *      struct i915_query_cache_header header;
+ *      struct i915_query_cache_item items[header.num_items];
+ *      __u8 data[];	// item payloads, each 8 byte aligned
+ *
+ * Only items accepted by i915_query_cache_cacheable() are stored. Results
+ * that change at runtime, such as the &drm_i915_memory_region_info
+ * unallocated_size of the memory region queries, perf configurations
+ * added through sysfs, CS timestamps and fabric connectivity, must always
+ * be queried. Items are looked up by query id and flags only, so queries
+ * that read an engine or region from the data buffer, such as
+ * %PRELIM_DRM_I915_QUERY_DISTANCE_INFO and
+ * %PRELIM_DRM_I915_QUERY_HW_IP_VERSION, are not stored either.
+ *
+ * The file is only valid for the card and kernel it was produced on.
+ * Topology and hwconfig reflect the fusing of the individual card, so
+ * struct i915_query_cache_key records the PCI address of the card next
+ * to the %I915_PARAM_CHIPSET_ID and %I915_PARAM_REVISION getparams, the
+ * DRM driver version from %DRM_IOCTL_VERSION and the PRELIM uAPI version.
+ * A cache whose key does not match the running device must be discarded.
+ *
+ * The file is written in host byte order and is not meant to be shared
+ * between machines.
+ */
+
+#define I915_QUERY_CACHE_MAGIC		0x51353139 /* "915Q" */
+#define I915_QUERY_CACHE_VERSION	1
+
+/**
+ * struct i915_query_cache_key - Identifies the card and kernel of a cache
+ */
+struct i915_query_cache_key {
+	/** @chipset_id: %I915_PARAM_CHIPSET_ID */
+	__u32 chipset_id;
+
+	/** @revision: %I915_PARAM_REVISION */
+	__u32 revision;
+
+	/** @drm_major: &drm_version.version_major */
+	__u32 drm_major;
+
+	/** @drm_minor: &drm_version.version_minor */
+	__u32 drm_minor;
+
+	/** @drm_patchlevel: &drm_version.version_patchlevel */
+	__u32 drm_patchlevel;
+
+	/** @prelim_major: %PRELIM_UAPI_MAJOR of the running kernel */
+	__u16 prelim_major;
+
+	/** @prelim_minor: %PRELIM_UAPI_MINOR of the running kernel */
+	__u16 prelim_minor;
+
+	/** @pci_domain: PCI domain of the card */
+	__u32 pci_domain;
+
+	/** @pci_bus: PCI bus of the card */
+	__u8 pci_bus;
+
+	/** @pci_dev: PCI device of the card */
+	__u8 pci_dev;
+
+	/** @pci_func: PCI function of the card */
+	__u8 pci_func;
+
+	__u8 pad;
+};
+
+/**
+ * struct i915_query_cache_item - One cached &drm_i915_query_item result
+ */
+struct i915_query_cache_item {
+	/** @query_id: &drm_i915_query_item.query_id */
+	__u64 query_id;
+
+	/** @flags: &drm_i915_query_item.flags */
+	__u32 flags;
+
+	/** @length: Payload size in bytes */
+	__u32 length;
+
+	/** @offset: Payload offset from the start of the file */
+	__u64 offset;
+};
+
+/**
+ * struct i915_query_cache_header - Start of a query cache file
+ */
+struct i915_query_cache_header {
+	/** @magic: %I915_QUERY_CACHE_MAGIC */
+	__u32 magic;
+
+	/** @version: %I915_QUERY_CACHE_VERSION */
+	__u32 version;
+
+	/** @key: Device and kernel the results were read from */
+	struct i915_query_cache_key key;
+
+	/** @num_items: Number of entries in @items */
+	__u32 num_items;
+
+	__u32 pad;
+
+	/** @size: Total size of the file in bytes */
+	__u64 size;
+
+	/** @items: Item descriptors, sorted as they were written */
+	struct i915_query_cache_item items[];
+};
+
+#define I915_QUERY_CACHE_ALIGN(x)	(((x) + 7) & ~(__u64)7)
+
+/**
+ * i915_query_cache_cacheable - Check whether a query result may be persisted
+ * @query_id: &drm_i915_query_item.query_id
+ *
+ * Return: non-zero if the result only depends on the card and the kernel.
+ */
+static inline int
+i915_query_cache_cacheable(__u64 query_id)
+{
+	switch (query_id) {
+	case DRM_I915_QUERY_TOPOLOGY_INFO:
+	case DRM_I915_QUERY_ENGINE_INFO:
+	case DRM_I915_QUERY_HWCONFIG_BLOB:
+	case DRM_I915_QUERY_GEOMETRY_SUBSLICES:
+	case PRELIM_DRM_I915_QUERY_HWCONFIG_TABLE:
+	case PRELIM_DRM_I915_QUERY_GEOMETRY_SUBSLICES:
+	case PRELIM_DRM_I915_QUERY_COMPUTE_SUBSLICES:
+	case PRELIM_DRM_I915_QUERY_ENGINE_INFO:
+	case PRELIM_DRM_I915_QUERY_L3BANK_COUNT:
+		return 1;
+	default:
+		/*
+		 * Memory regions, perf configs, CS cycles, fabric info, and
+		 * distance info and HW IP version, whose engine or region
+		 * input is not part of the item key
+		 */
+		return 0;
+	}
+}
+
+/* Whether i915_query_cache_write() stores an item */
+static inline int
+__i915_query_cache_stored(const struct drm_i915_query_item *item)
+{
+	return item->length > 0 && i915_query_cache_cacheable(item->query_id);
+}
+
+/**
+ * i915_query_cache_size - Bytes needed to store a set of query results
+ * @items: query items with &drm_i915_query_item.length filled by the kernel
+ * @num_items: number of entries in @items
+ *
+ * Items with a negative or zero length (failed or unsupported queries)
+ * and items rejected by i915_query_cache_cacheable() are not stored.
+ */
+static inline __u64
+i915_query_cache_size(const struct drm_i915_query_item *items, __u32 num_items)
+{
+	__u64 size = sizeof(struct i915_query_cache_header);
+	__u32 i;
+
+	for (i = 0; i < num_items; i++) {
+		if (!__i915_query_cache_stored(&items[i]))
+			continue;
+
+		size += sizeof(struct i915_query_cache_item);
+	}
+
+	size = I915_QUERY_CACHE_ALIGN(size);
+	for (i = 0; i < num_items; i++) {
+		if (!__i915_query_cache_stored(&items[i]))
+			continue;
+
+		size += I915_QUERY_CACHE_ALIGN(items[i].length);
+	}
+
+	return size;
+}
+
+/**
+ * i915_query_cache_write - Serialise query results into a buffer
+ * @buf: 8 byte aligned destination of i915_query_cache_size() bytes
+ * @size: size of @buf
+ * @key: identity of the device the results were read from
+ * @items: filled query items; &drm_i915_query_item.data_ptr must still
+ *	   point to the results
+ * @num_items: number of entries in @items
+ *
+ * The caller is expected to write @buf to a temporary file and rename() it
+ * into place so that readers never see a partial cache.
+ *
+ * Return: 0 on success, -ENOSPC if @buf is too small.
+ */
+static inline int
+i915_query_cache_write(void *buf, __u64 size,
+		       const struct i915_query_cache_key *key,
+		       const struct drm_i915_query_item *items, __u32 num_items)
+{
+	struct i915_query_cache_header *hdr = (struct i915_query_cache_header *)buf;
+	__u64 need = i915_query_cache_size(items, num_items);
+	__u64 offset;
+	__u32 i, n = 0;
+
+	if (size < need)
+		return -ENOSPC;
+
+	memset(buf, 0, need);
+	hdr->magic = I915_QUERY_CACHE_MAGIC;
+	hdr->version = I915_QUERY_CACHE_VERSION;
+	hdr->key = *key;
+	hdr->size = need;
+
+	for (i = 0; i < num_items; i++)
+		n += __i915_query_cache_stored(&items[i]);
+	hdr->num_items = n;
+
+	offset = I915_QUERY_CACHE_ALIGN(sizeof(*hdr) + n * sizeof(hdr->items[0]));
+	for (i = 0, n = 0; i < num_items; i++) {
+		struct i915_query_cache_item *it = &hdr->items[n];
+
+		if (!__i915_query_cache_stored(&items[i]))
+			continue;
+
+		it->query_id = items[i].query_id;
+		it->flags = items[i].flags;
+		it->length = items[i].length;
+		it->offset = offset;
+		memcpy((__u8 *)buf + offset,
+		       (const void *)(uintptr_t)items[i].data_ptr,
+		       items[i].length);
+
+		offset += I915_QUERY_CACHE_ALIGN(items[i].length);
+		n++;
+	}
+
+	return 0;
+}
+
+/**
+ * i915_query_cache_validate - Check a mapped cache against the running device
+ * @map: start of the mapped file
+ * @size: size of the mapping
+ * @key: identity of the running device and kernel
+ *
+ * Return: 0 if the cache can be used, -ESTALE if it was written for another
+ * device or kernel, -EINVAL if it is corrupt or truncated.
+ */
+static inline int
+i915_query_cache_validate(const void *map, __u64 size,
+			  const struct i915_query_cache_key *key)
+{
+	const struct i915_query_cache_header *hdr =
+		(const struct i915_query_cache_header *)map;
+	__u32 i;
+
+	if (size < sizeof(*hdr) ||
+	    hdr->magic != I915_QUERY_CACHE_MAGIC ||
+	    hdr->version != I915_QUERY_CACHE_VERSION ||
+	    hdr->size != size)
+		return -EINVAL;
+
+	if (hdr->key.chipset_id != key->chipset_id ||
+	    hdr->key.revision != key->revision ||
+	    hdr->key.drm_major != key->drm_major ||
+	    hdr->key.drm_minor != key->drm_minor ||
+	    hdr->key.drm_patchlevel != key->drm_patchlevel ||
+	    hdr->key.prelim_major != key->prelim_major ||
+	    hdr->key.prelim_minor != key->prelim_minor ||
+	    hdr->key.pci_domain != key->pci_domain ||
+	    hdr->key.pci_bus != key->pci_bus ||
+	    hdr->key.pci_dev != key->pci_dev ||
+	    hdr->key.pci_func != key->pci_func)
+		return -ESTALE;
+
+	if (hdr->num_items > (size - sizeof(*hdr)) / sizeof(hdr->items[0]))
+		return -EINVAL;
+
+	for (i = 0; i < hdr->num_items; i++) {
+		const struct i915_query_cache_item *it = &hdr->items[i];
+
+		if (it->offset & 7 || it->offset > size ||
+		    it->length > size - it->offset)
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * i915_query_cache_find - Look up a cached query result
+ * @map: start of a mapping accepted by i915_query_cache_validate()
+ * @query_id: &drm_i915_query_item.query_id to look for
+ * @flags: &drm_i915_query_item.flags the result was queried with
+ * @length: returns the payload size in bytes
+ *
+ * Return: pointer to the payload inside @map, or NULL if it was not cached.
+ */
+static inline const void *
+i915_query_cache_find(const void *map, __u64 query_id, __u32 flags,
+		      __u32 *length)
+{
+	const struct i915_query_cache_header *hdr =
+		(const struct i915_query_cache_header *)map;
+	__u32 i;
+
+	for (i = 0; i < hdr->num_items; i++) {
+		const struct i915_query_cache_item *it = &hdr->items[i];
+
+		if (it->query_id == query_id && it->flags == flags) {
+			*length = it->length;
+			return (const __u8 *)map + it->offset;
+		}
+	}
+
+	return NULL;
+}
+
+#endif /* _I915_QUERY_CACHE_H_ */
@@ -0,0 +1,555 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_RESET_MONITOR_H_
+#define _I915_RESET_MONITOR_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "i915_drm.h"
+
+/**
+ * DOC: Reset and memory health monitor
+ *
+ * One monitor process polls %PRELIM_DRM_IOCTL_I915_GET_RESET_STATS for the
+ * contexts it tracks and listens for the %PRELIM_I915_RESET_FAILED_UEVENT,
+ * %PRELIM_I915_MEMORY_HEALTH_UEVENT, %I915_RESET_UEVENT and
+ * %I915_ERROR_UEVENT uevents. It publishes the result in a struct
+ * i915_reset_page, which fits in one 4 KiB page. Place the page in shared
+ * memory, for example from shm_open() or a memfd passed to the readers, and
+ * any process can then read it without a syscall:
+ *
+ *   .. code:: c
+ *
+ *      struct i915_reset_counters c;
+ *
+ *      i915_reset_page_counters(page, &c);
+ *      if (c.memory_health)
+ *              drain_and_reboot();
+ *
+ * There is a single writer. Readers detect concurrent updates through a
+ * sequence count and retry, as with struct i915_vm_mirror.
+ *
+ * The ioctl and the uevent source are callbacks, so tests can feed the
+ * monitor from a fake device and a fake uevent stream.
+ */
+
+#define I915_RESET_PAGE_MAGIC		0x49525350 /* "IRSP" */
+#define I915_RESET_PAGE_VERSION		1
+#define I915_RESET_PAGE_CONTEXTS	126
+
+/**
+ * struct i915_reset_counters - Device-wide counters
+ */
+struct i915_reset_counters {
+	/** @reset_count: &prelim_drm_i915_reset_stats.reset_count last seen */
+	__u32 reset_count;
+
+	/** @reset_failed: %PRELIM_I915_RESET_FAILED_UEVENT events */
+	__u32 reset_failed;
+
+	/** @memory_health: %PRELIM_I915_MEMORY_HEALTH_UEVENT events */
+	__u32 memory_health;
+
+	/** @reset_events: %I915_RESET_UEVENT events */
+	__u32 reset_events;
+
+	/** @error_events: %I915_ERROR_UEVENT events */
+	__u32 error_events;
+
+	/** @faults: New faults reported across the tracked contexts */
+	__u32 faults;
+
+	/** @banned: Tracked contexts that got banned */
+	__u32 banned;
+
+	__u32 pad;
+
+	/** @batch_active: Batches lost while active, across tracked contexts */
+	__u64 batch_active;
+
+	/** @batch_pending: Batches lost while pending, across tracked contexts */
+	__u64 batch_pending;
+};
+
+/**
+ * struct i915_reset_context - Last reset stats of one tracked context
+ */
+struct i915_reset_context {
+	__u32 ctx_id;
+	__u32 status;
+	__u32 batch_active;
+	__u32 batch_pending;
+	__u64 fault_addr;
+	__u16 fault_type;
+	__u16 fault_level;
+	__u16 fault_access;
+	__u16 fault_flags;
+};
+
+/**
+ * struct i915_reset_page - Shared counter page
+ */
+struct i915_reset_page {
+	__u32 magic;
+	__u32 version;
+
+	/** @seq: Odd while an update is in progress */
+	__u32 seq;
+
+	/** @num_contexts: Valid entries in @contexts */
+	__u32 num_contexts;
+
+	struct i915_reset_counters counters;
+
+	struct i915_reset_context contexts[I915_RESET_PAGE_CONTEXTS];
+};
+
+/**
+ * i915_reset_page_init - Initialise the page, before readers attach
+ * @page: page, usually in shared memory
+ */
+static inline void
+i915_reset_page_init(struct i915_reset_page *page)
+{
+	memset(page, 0, sizeof(*page));
+	page->magic = I915_RESET_PAGE_MAGIC;
+	page->version = I915_RESET_PAGE_VERSION;
+}
+
+static inline void
+__i915_reset_write_begin(struct i915_reset_page *page)
+{
+	__atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void
+__i915_reset_write_end(struct i915_reset_page *page)
+{
+	__atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * i915_reset_page_read_begin - Start a lockless read of the page
+ * @page: page
+ *
+ * Return: the sequence to pass to i915_reset_page_read_retry().
+ */
+static inline __u32
+i915_reset_page_read_begin(const struct i915_reset_page *page)
+{
+	__u32 seq;
+
+	while ((seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE)) & 1)
+		;
+
+	return seq;
+}
+
+/**
+ * i915_reset_page_read_retry - Check whether a read raced with an update
+ * @page: page
+ * @seq: value returned by i915_reset_page_read_begin()
+ */
+static inline int
+i915_reset_page_read_retry(const struct i915_reset_page *page, __u32 seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/**
+ * i915_reset_page_counters - Copy a consistent snapshot of the counters
+ * @page: page
+ * @out: snapshot
+ *
+ * Return: 0 on success, -EPROTO if the page is not a version 1 page.
+ */
+static inline int
+i915_reset_page_counters(const struct i915_reset_page *page,
+			 struct i915_reset_counters *out)
+{
+	__u32 seq;
+
+	if (page->magic != I915_RESET_PAGE_MAGIC ||
+	    page->version != I915_RESET_PAGE_VERSION)
+		return -EPROTO;
+
+	do {
+		seq = i915_reset_page_read_begin(page);
+		memcpy(out, &page->counters, sizeof(*out));
+	} while (i915_reset_page_read_retry(page, seq));
+
+	return 0;
+}
+
+/**
+ * i915_reset_page_context - Copy a consistent snapshot of one context
+ * @page: page
+ * @ctx_id: context to look up
+ * @out: snapshot
+ *
+ * Return: 0 on success, -ENOENT if the context is not tracked.
+ */
+static inline int
+i915_reset_page_context(const struct i915_reset_page *page, __u32 ctx_id,
+			struct i915_reset_context *out)
+{
+	__u32 seq, i, n;
+	int ret;
+
+	do {
+		seq = i915_reset_page_read_begin(page);
+		ret = -ENOENT;
+		n = page->num_contexts;
+		for (i = 0; i < n && i < I915_RESET_PAGE_CONTEXTS; i++) {
+			if (page->contexts[i].ctx_id == ctx_id) {
+				memcpy(out, &page->contexts[i], sizeof(*out));
+				ret = 0;
+				break;
+			}
+		}
+	} while (i915_reset_page_read_retry(page, seq));
+
+	return ret;
+}
+
+/**
+ * i915_reset_track - Start tracking a context
+ * @page: page owned by the monitor
+ * @ctx_id: context id, 0 for the default context
+ *
+ * Return: 0 on success, -EEXIST if it is already tracked or -ENOSPC if the
+ * page is full.
+ */
+static inline int
+i915_reset_track(struct i915_reset_page *page, __u32 ctx_id)
+{
+	struct i915_reset_context *c;
+	__u32 i;
+
+	for (i = 0; i < page->num_contexts; i++) {
+		if (page->contexts[i].ctx_id == ctx_id)
+			return -EEXIST;
+	}
+	if (page->num_contexts == I915_RESET_PAGE_CONTEXTS)
+		return -ENOSPC;
+
+	__i915_reset_write_begin(page);
+	c = &page->contexts[page->num_contexts];
+	memset(c, 0, sizeof(*c));
+	c->ctx_id = ctx_id;
+	page->num_contexts++;
+	__i915_reset_write_end(page);
+
+	return 0;
+}
+
+static inline void
+__i915_reset_untrack(struct i915_reset_page *page, __u32 i)
+{
+	page->contexts[i] = page->contexts[--page->num_contexts];
+}
+
+/**
+ * i915_reset_untrack - Stop tracking a context
+ * @page: page owned by the monitor
+ * @ctx_id: context id
+ *
+ * Return: 0 on success, -ENOENT if it is not tracked.
+ */
+static inline int
+i915_reset_untrack(struct i915_reset_page *page, __u32 ctx_id)
+{
+	__u32 i;
+
+	for (i = 0; i < page->num_contexts; i++) {
+		if (page->contexts[i].ctx_id == ctx_id) {
+			__i915_reset_write_begin(page);
+			__i915_reset_untrack(page, i);
+			__i915_reset_write_end(page);
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * typedef i915_reset_ioctl_fn - Issue %PRELIM_DRM_IOCTL_I915_GET_RESET_STATS
+ * @ctx: opaque pointer passed along
+ * @request: %PRELIM_DRM_IOCTL_I915_GET_RESET_STATS
+ * @arg: struct prelim_drm_i915_reset_stats, with @ctx_id set
+ *
+ * Return: 0 on success or a negative error code.
+ */
+typedef int (*i915_reset_ioctl_fn)(void *ctx, unsigned long request, void *arg);
+
+/**
+ * i915_reset_poll - Refresh the reset stats of every tracked context
+ * @page: page owned by the monitor
+ * @fn: ioctl callback
+ * @ctx: passed to @fn
+ *
+ * Lost batches are accumulated into the device-wide counters as deltas, a
+ * fault is counted when its address or flags change and a ban when
+ * %I915_RESET_STATS_BANNED first appears. Contexts the kernel no longer
+ * knows about (-ENOENT) are dropped.
+ *
+ * Return: the number of contexts whose stats changed, or the first error
+ * other than -ENOENT.
+ */
+static inline int
+i915_reset_poll(struct i915_reset_page *page, i915_reset_ioctl_fn fn, void *ctx)
+{
+	struct prelim_drm_i915_reset_stats st;
+	int changed = 0, ret = 0;
+	__u32 i = 0;
+
+	while (i < page->num_contexts) {
+		struct i915_reset_context *c = &page->contexts[i];
+		struct i915_reset_counters *cnt = &page->counters;
+
+		memset(&st, 0, sizeof(st));
+		st.ctx_id = c->ctx_id;
+		ret = fn(ctx, PRELIM_DRM_IOCTL_I915_GET_RESET_STATS, &st);
+		if (ret == -ENOENT) {
+			__i915_reset_write_begin(page);
+			__i915_reset_untrack(page, i);
+			__i915_reset_write_end(page);
+			ret = 0;
+			continue;
+		}
+		if (ret)
+			break;
+
+		if (st.batch_active == c->batch_active &&
+		    st.batch_pending == c->batch_pending &&
+		    st.status == c->status &&
+		    st.fault.addr == c->fault_addr &&
+		    st.fault.flags == c->fault_flags) {
+			if (st.reset_count != cnt->reset_count) {
+				__i915_reset_write_begin(page);
+				cnt->reset_count = st.reset_count;
+				__i915_reset_write_end(page);
+			}
+			i++;
+			continue;
+		}
+
+		__i915_reset_write_begin(page);
+		cnt->reset_count = st.reset_count;
+		cnt->batch_active += (__u32)(st.batch_active - c->batch_active);
+		cnt->batch_pending += (__u32)(st.batch_pending - c->batch_pending);
+		if (st.fault.flags & I915_RESET_STATS_FAULT_VALID &&
+		    (st.fault.addr != c->fault_addr || !(c->fault_flags & I915_RESET_STATS_FAULT_VALID)))
+			cnt->faults++;
+		if (st.status & ~c->status & I915_RESET_STATS_BANNED)
+			cnt->banned++;
+
+		c->status = st.status;
+		c->batch_active = st.batch_active;
+		c->batch_pending = st.batch_pending;
+		c->fault_addr = st.fault.addr;
+		c->fault_type = st.fault.type;
+		c->fault_level = st.fault.level;
+		c->fault_access = st.fault.access;
+		c->fault_flags = st.fault.flags;
+		__i915_reset_write_end(page);
+
+		changed++;
+		i++;
+	}
+
+	return ret ? ret : changed;
+}
+
+#define I915_RESET_EV_RESET_FAILED	(1 << 0)
+#define I915_RESET_EV_MEMORY_HEALTH	(1 << 1)
+#define I915_RESET_EV_RESET		(1 << 2)
+#define I915_RESET_EV_ERROR		(1 << 3)
+
+static inline int
+__i915_reset_uevent_key(const char *kv, size_t len, const char *key)
+{
+	size_t n = strlen(key);
+
+	return len > n && !memcmp(kv, key, n) && kv[n] == '=';
+}
+
+/**
+ * i915_reset_uevent_parse - Classify one kernel uevent message
+ * @msg: message as received from the NETLINK_KOBJECT_UEVENT socket, an
+ *	 "action@devpath" header followed by NUL separated KEY=value pairs
+ * @len: length of @msg
+ *
+ * Return: a mask of I915_RESET_EV_*, 0 for messages that are not drm
+ * uevents or carry none of them.
+ */
+static inline unsigned int
+i915_reset_uevent_parse(const char *msg, size_t len)
+{
+	unsigned int events = 0;
+	int drm = 0;
+	size_t off;
+
+	/* Skip the header, messages relayed by udev do not have one */
+	off = strnlen(msg, len);
+	if (!memchr(msg, '@', off))
+		return 0;
+	off++;
+
+	while (off < len) {
+		const char *kv = msg + off;
+		size_t n = strnlen(kv, len - off);
+
+		if (n == sizeof("SUBSYSTEM=drm") - 1 && !memcmp(kv, "SUBSYSTEM=drm", n))
+			drm = 1;
+		else if (__i915_reset_uevent_key(kv, n, PRELIM_I915_RESET_FAILED_UEVENT))
+			events |= I915_RESET_EV_RESET_FAILED;
+		else if (__i915_reset_uevent_key(kv, n, PRELIM_I915_MEMORY_HEALTH_UEVENT))
+			events |= I915_RESET_EV_MEMORY_HEALTH;
+		else if (__i915_reset_uevent_key(kv, n, I915_RESET_UEVENT))
+			events |= I915_RESET_EV_RESET;
+		else if (__i915_reset_uevent_key(kv, n, I915_ERROR_UEVENT))
+			events |= I915_RESET_EV_ERROR;
+
+		off += n + 1;
+	}
+
+	return drm ? events : 0;
+}
+
+/**
+ * typedef i915_uevent_recv_fn - Receive one uevent message
+ * @ctx: opaque pointer passed along
+ * @buf: destination
+ * @len: size of @buf
+ *
+ * Return: the message length, or -EAGAIN when no message is queued, or
+ * another negative error code.
+ */
+typedef long (*i915_uevent_recv_fn)(void *ctx, void *buf, size_t len);
+
+/**
+ * i915_reset_uevents - Drain queued uevents into the page
+ * @page: page owned by the monitor
+ * @recv: uevent source
+ * @ctx: passed to @recv
+ *
+ * A caller seeing %I915_RESET_EV_RESET or %I915_RESET_EV_RESET_FAILED in
+ * the result would typically follow with i915_reset_poll().
+ *
+ * Return: the mask of I915_RESET_EV_* seen, or a negative error code.
+ */
+static inline int
+i915_reset_uevents(struct i915_reset_page *page, i915_uevent_recv_fn recv,
+		   void *ctx)
+{
+	struct i915_reset_counters *cnt = &page->counters;
+	char buf[4096];
+	int seen = 0;
+	long len;
+
+	while ((len = recv(ctx, buf, sizeof(buf))) > 0) {
+		unsigned int ev = i915_reset_uevent_parse(buf, len);
+
+		if (!ev)
+			continue;
+
+		__i915_reset_write_begin(page);
+		cnt->reset_failed += !!(ev & I915_RESET_EV_RESET_FAILED);
+		cnt->memory_health += !!(ev & I915_RESET_EV_MEMORY_HEALTH);
+		cnt->reset_events += !!(ev & I915_RESET_EV_RESET);
+		cnt->error_events += !!(ev & I915_RESET_EV_ERROR);
+		__i915_reset_write_end(page);
+
+		seen |= ev;
+	}
+
+	return len < 0 && len != -EAGAIN ? (int)len : seen;
+}
+
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * i915_reset_stats_ioctl - &i915_reset_ioctl_fn backed by a DRM fd
+ * @ctx: pointer to an int holding the fd
+ * @request: %PRELIM_DRM_IOCTL_I915_GET_RESET_STATS
+ * @arg: ioctl argument
+ */
+static inline int
+i915_reset_stats_ioctl(void *ctx, unsigned long request, void *arg)
+{
+	int fd = *(int *)ctx;
+	int ret;
+
+	do {
+		ret = ioctl(fd, request, arg);
+	} while (ret == -1 && errno == EINTR);
+
+	return ret ? -errno : 0;
+}
+
+/**
+ * i915_uevent_open - Open a non-blocking kernel uevent socket
+ *
+ * Return: the socket fd, or a negative error code.
+ */
+static inline int
+i915_uevent_open(void)
+{
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		int err = errno;
+
+		close(fd);
+		return -err;
+	}
+
+	return fd;
+}
+
+/**
+ * i915_uevent_recv_fd - &i915_uevent_recv_fn backed by i915_uevent_open()
+ * @ctx: pointer to an int holding the socket fd
+ * @buf: destination
+ * @len: size of @buf
+ */
+static inline long
+i915_uevent_recv_fd(void *ctx, void *buf, size_t len)
+{
+	int fd = *(int *)ctx;
+	ssize_t ret;
+
+	do {
+		ret = recv(fd, buf, len, 0);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret < 0)
+		return errno == EWOULDBLOCK ? -EAGAIN : -errno;
+
+	return ret;
+}
+#endif
+
+#endif /* _I915_RESET_MONITOR_H_ */
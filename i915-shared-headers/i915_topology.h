@@ -0,0 +1,290 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_TOPOLOGY_H_
+#define _I915_TOPOLOGY_H_
+
+#include <errno.h>
+
+#include "i915_drm.h"
+
+/**
+ * DOC: Topology mask decoding
+ *
+ * The masks returned by %DRM_I915_QUERY_TOPOLOGY_INFO,
+ * %DRM_I915_QUERY_GEOMETRY_SUBSLICES, %PRELIM_DRM_I915_QUERY_GEOMETRY_SUBSLICES
+ * and %PRELIM_DRM_I915_QUERY_COMPUTE_SUBSLICES all use the layout of struct
+ * drm_i915_query_topology_info. i915_topology_decode() walks it once, a
+ * 64-bit word at a time with popcount, and produces one
+ * struct i915_topology_subslice per (slice, subslice) pair. The table can then
+ * answer "how many EUs precede this one" in constant time and "where is the
+ * n-th enabled EU" with a binary search over subslices followed by a
+ * constant-time select within the subslice's 64-bit mask.
+ *
+ * Callers that select on a hot path can build a rank index with
+ * i915_topology_eu_index_init(), one __u16 per enabled EU, after which
+ * i915_topology_eu_select_indexed() runs in constant time.
+ *
+ * Subslices are numbered linearly as slice * max_subslices + subslice, which
+ * is the same order as the EU masks in the query data.
+ */
+
+/**
+ * struct i915_topology_subslice - Decoded EU mask of one subslice
+ */
+struct i915_topology_subslice {
+	/** @eu_mask: Enabled EUs, bit N is EU N */
+	__u64 eu_mask;
+
+	/** @eu_count: Number of bits set in @eu_mask */
+	__u32 eu_count;
+
+	/** @eu_base: Enabled EUs in all preceding subslices */
+	__u32 eu_base;
+};
+
+static inline __u64
+__i915_topology_load(const __u8 *data, __u32 bytes)
+{
+	__u64 mask = 0;
+	__u32 i;
+
+	for (i = 0; i < bytes && i < sizeof(mask); i++)
+		mask |= (__u64)data[i] << (8 * i);
+
+	return mask;
+}
+
+/**
+ * i915_topology_count - Count set bits in a byte-granular mask
+ * @data: first byte of the mask
+ * @bits: number of valid bits
+ */
+static inline __u32
+i915_topology_count(const __u8 *data, __u32 bits)
+{
+	__u32 count = 0;
+
+	for (; bits >= 64; bits -= 64, data += 8)
+		count += __builtin_popcountll(__i915_topology_load(data, 8));
+
+	if (bits)
+		count += __builtin_popcountll(__i915_topology_load(data, (bits + 7) / 8) &
+					      (~0ull >> (64 - bits)));
+
+	return count;
+}
+
+/**
+ * i915_topology_subslice_enabled - Check whether a subslice is present
+ * @info: query result
+ * @slice: slice index
+ * @subslice: subslice index within @slice
+ */
+static inline int
+i915_topology_subslice_enabled(const struct drm_i915_query_topology_info *info,
+			       __u32 slice, __u32 subslice)
+{
+	return (info->data[info->subslice_offset +
+			   slice * info->subslice_stride +
+			   subslice / 8] >> (subslice % 8)) & 1;
+}
+
+/**
+ * i915_topology_decode - Build the per-subslice EU table
+ * @info: query result
+ * @table: array of @info->max_slices * @info->max_subslices entries,
+ *	   preferably cache line aligned
+ * @entries: number of entries in @table
+ *
+ * Subslices that are fused off, or belong to a disabled slice, get an empty
+ * EU mask regardless of what the EU masks contain.
+ *
+ * Return: total number of enabled EUs, or -EINVAL if @table is too small
+ * or a subslice has more than 64 EUs.
+ */
+static inline int
+i915_topology_decode(const struct drm_i915_query_topology_info *info,
+		     struct i915_topology_subslice *table, __u32 entries)
+{
+	__u32 s, ss, base = 0;
+
+	if (entries < (__u32)info->max_slices * info->max_subslices ||
+	    info->max_eus_per_subslice > 64)
+		return -EINVAL;
+
+	for (s = 0; s < info->max_slices; s++) {
+		int slice_on = (info->data[s / 8] >> (s % 8)) & 1;
+
+		for (ss = 0; ss < info->max_subslices; ss++) {
+			struct i915_topology_subslice *t =
+				&table[s * info->max_subslices + ss];
+			__u64 mask = 0;
+
+			if (slice_on && i915_topology_subslice_enabled(info, s, ss)) {
+				mask = __i915_topology_load(&info->data[info->eu_offset +
+									(s * info->max_subslices + ss) *
+									info->eu_stride],
+							    info->eu_stride);
+				if (info->max_eus_per_subslice < 64)
+					mask &= (1ull << info->max_eus_per_subslice) - 1;
+			}
+
+			t->eu_mask = mask;
+			t->eu_count = __builtin_popcountll(mask);
+			t->eu_base = base;
+			base += t->eu_count;
+		}
+	}
+
+	return base;
+}
+
+/**
+ * i915_topology_eu_rank - Number of enabled EUs before a given EU
+ * @table: table filled by i915_topology_decode()
+ * @subslice: linear subslice index
+ * @eu: EU index within @subslice, at most 64
+ */
+static inline __u32
+i915_topology_eu_rank(const struct i915_topology_subslice *table,
+		      __u32 subslice, __u32 eu)
+{
+	const struct i915_topology_subslice *t = &table[subslice];
+	__u64 below = eu < 64 ? (1ull << eu) - 1 : ~0ull;
+
+	return t->eu_base + __builtin_popcountll(t->eu_mask & below);
+}
+
+#define __I915_TOPOLOGY_L8	0x0101010101010101ull
+#define __I915_TOPOLOGY_H8	0x8080808080808080ull
+
+/* Bytes of @x at most @k, where every byte of @x is below 0x80 */
+static inline __u32
+__i915_topology_bytes_le(__u64 x, __u32 k)
+{
+	return __builtin_popcountll(((k * __I915_TOPOLOGY_L8 | __I915_TOPOLOGY_H8) - x) &
+				    __I915_TOPOLOGY_H8);
+}
+
+/*
+ * Position of the @k-th (zero based) set bit of @x, which must have more
+ * than @k bits set. Broadword select without branches or loops: the first
+ * step finds the byte holding the bit from the byte-wise prefix popcounts,
+ * the second repeats the same within that byte.
+ */
+static inline __u32
+__i915_topology_select64(__u64 x, __u32 k)
+{
+	__u64 s, bits;
+	__u32 byte, v;
+
+	s = x - ((x >> 1) & 0x5555555555555555ull);
+	s = (s & 0x3333333333333333ull) + ((s >> 2) & 0x3333333333333333ull);
+	s = ((s + (s >> 4)) & 0x0f0f0f0f0f0f0f0full) * __I915_TOPOLOGY_L8;
+
+	byte = __i915_topology_bytes_le(s, k);
+	k -= (__u32)(s << 8 >> (byte * 8)) & 0xff;
+	v = (__u32)(x >> (byte * 8)) & 0xff;
+
+	/* Spread the bits of @v over the bytes, then prefix sum them */
+	bits = ((v * __I915_TOPOLOGY_L8 & 0x8040201008040201ull) + 0x7f7f7f7f7f7f7f7full) &
+	       __I915_TOPOLOGY_H8;
+	bits = (bits >> 7) * __I915_TOPOLOGY_L8;
+
+	return byte * 8 + __i915_topology_bytes_le(bits, k);
+}
+
+/**
+ * i915_topology_eu_select - Locate the n-th enabled EU
+ * @table: table filled by i915_topology_decode()
+ * @entries: number of entries in @table
+ * @n: zero based rank of the EU
+ * @subslice: returns the linear subslice index
+ * @eu: returns the EU index within @subslice
+ *
+ * Return: 0 on success, -ERANGE if fewer than @n + 1 EUs are enabled.
+ */
+static inline int
+i915_topology_eu_select(const struct i915_topology_subslice *table,
+			__u32 entries, __u32 n, __u32 *subslice, __u32 *eu)
+{
+	__u32 lo = 0, hi = entries;
+
+	if (!entries ||
+	    n >= table[entries - 1].eu_base + table[entries - 1].eu_count)
+		return -ERANGE;
+
+	/*
+	 * Last subslice whose eu_base is <= n. Empty subslices share the
+	 * eu_base of the next one, so this always lands on one holding n.
+	 */
+	while (hi - lo > 1) {
+		__u32 mid = lo + (hi - lo) / 2;
+
+		if (table[mid].eu_base <= n)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	*subslice = lo;
+	*eu = __i915_topology_select64(table[lo].eu_mask, n - table[lo].eu_base);
+	return 0;
+}
+
+/**
+ * i915_topology_eu_index_init - Build a rank to subslice index
+ * @table: table filled by i915_topology_decode()
+ * @entries: number of entries in @table
+ * @index: one entry per enabled EU, as returned by i915_topology_decode()
+ *
+ * Return: 0 on success, -ERANGE if @entries does not fit a __u16.
+ */
+static inline int
+i915_topology_eu_index_init(const struct i915_topology_subslice *table,
+			    __u32 entries, __u16 *index)
+{
+	__u32 ss, k;
+
+	if (entries > 0x10000)
+		return -ERANGE;
+
+	for (ss = 0; ss < entries; ss++) {
+		for (k = 0; k < table[ss].eu_count; k++)
+			index[table[ss].eu_base + k] = ss;
+	}
+
+	return 0;
+}
+
+/**
+ * i915_topology_eu_select_indexed - Locate the n-th enabled EU in constant time
+ * @table: table filled by i915_topology_decode()
+ * @index: index filled by i915_topology_eu_index_init()
+ * @total: number of enabled EUs, as returned by i915_topology_decode()
+ * @n: zero based rank of the EU
+ * @subslice: returns the linear subslice index
+ * @eu: returns the EU index within @subslice
+ *
+ * Return: 0 on success, -ERANGE if @n >= @total.
+ */
+static inline int
+i915_topology_eu_select_indexed(const struct i915_topology_subslice *table,
+				const __u16 *index, __u32 total, __u32 n,
+				__u32 *subslice, __u32 *eu)
+{
+	const struct i915_topology_subslice *t;
+
+	if (n >= total)
+		return -ERANGE;
+
+	t = &table[index[n]];
+	*subslice = index[n];
+	*eu = __i915_topology_select64(t->eu_mask, n - t->eu_base);
+	return 0;
+}
+
+#endif /* _I915_TOPOLOGY_H_ */
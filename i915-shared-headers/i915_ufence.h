@@ -0,0 +1,426 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_UFENCE_H_
+#define _I915_UFENCE_H_
+
+#include <errno.h>
+#include <string.h>
+
+#include "i915_drm.h"
+
+/**
+ * DOC: User fence waiter
+ *
+ * A &prelim_drm_i915_gem_execbuffer_ext_user_fence or
+ * &prelim_drm_i915_vm_bind_ext_user_fence makes the GPU write a value to a
+ * qword once the work is done. Instead of each thread sleeping in its own
+ * %PRELIM_DRM_IOCTL_I915_GEM_WAIT_USER_FENCE, struct i915_ufence_set lets
+ * one thread wait on many fences:
+ *
+ *   .. code:: c
+ *
+ *      while (set.count) {
+ *              ret = i915_ufence_set_wait(&set, i915_ufence_now(), park_ns,
+ *                                         i915_ufence_wait_ioctl, &fd);
+ *              if (ret < 0)
+ *                      break;
+ *      }
+ *
+ * Every call polls all fences from the CPU, running the completion callback
+ * of those that signalled or whose deadline has passed. If none completed,
+ * it spins for a while re-polling. The spin budget doubles whenever spinning
+ * pays off and halves whenever it does not. Once the budget is spent it
+ * parks in a single kernel wait on the fence with the earliest deadline.
+ * The kernel can only watch one address per wait, so @park_ns bounds how
+ * long other fences may go unnoticed.
+ *
+ * The fence memory must be mapped in the CPU address space as well, through
+ * a userptr or shared virtual memory, so it can be polled. The kernel wait
+ * goes through a callback, so the set can be driven by a fake that just
+ * sleeps while another thread writes the fences.
+ */
+
+#define I915_UFENCE_NO_DEADLINE		0x7fffffffffffffffll
+#define I915_UFENCE_SPIN_MIN		16
+#define I915_UFENCE_SPIN_MAX		4096
+
+/**
+ * i915_ufence_check - Evaluate a user fence condition
+ * @op: one of the PRELIM_I915_UFENCE_WAIT_* operations
+ * @cur: current fence value
+ * @value: value to compare against
+ * @mask: bits taking part in the comparison, e.g.
+ *	  %PRELIM_I915_UFENCE_WAIT_U32
+ *
+ * Computes ``(cur & mask) OP (value & mask)``. %PRELIM_I915_UFENCE_WAIT_BEFORE
+ * and %PRELIM_I915_UFENCE_WAIT_AFTER compare sequence numbers that may wrap
+ * at the width of @mask: the fence is before @value when the masked
+ * difference lies in the upper half of the range. They require @mask to
+ * cover the low bits, like the PRELIM_I915_UFENCE_WAIT_U* masks.
+ *
+ * Return: non-zero when the condition holds.
+ */
+static inline int
+i915_ufence_check(__u16 op, __u64 cur, __u64 value, __u64 mask)
+{
+	__u64 a = cur & mask, b = value & mask;
+	__u64 d = (a - b) & mask;
+
+	switch (op) {
+	case PRELIM_I915_UFENCE_WAIT_EQ:
+		return a == b;
+	case PRELIM_I915_UFENCE_WAIT_NEQ:
+		return a != b;
+	case PRELIM_I915_UFENCE_WAIT_GT:
+		return a > b;
+	case PRELIM_I915_UFENCE_WAIT_GTE:
+		return a >= b;
+	case PRELIM_I915_UFENCE_WAIT_LT:
+		return a < b;
+	case PRELIM_I915_UFENCE_WAIT_LTE:
+		return a <= b;
+	case PRELIM_I915_UFENCE_WAIT_BEFORE:
+		return d > mask >> 1;
+	case PRELIM_I915_UFENCE_WAIT_AFTER:
+		return d && d <= mask >> 1;
+	}
+
+	return 0;
+}
+
+/**
+ * struct i915_ufence_array - Fences laid out as a structure of arrays
+ *
+ * All arrays hold @count entries. @op entries that are not a
+ * PRELIM_I915_UFENCE_WAIT_* operation never complete.
+ */
+struct i915_ufence_array {
+	const __u64 *const *ptr;
+	const __u64 *value;
+	const __u64 *mask;
+	const __u16 *op;
+	__u32 count;
+};
+
+/**
+ * i915_ufence_array_check - Evaluate many fence conditions at once
+ * @fences: fences to evaluate
+ * @done: bitmask with one bit per fence, (@fences->count + 63) / 64 words,
+ *	  bit N of word W set when fence 64 * W + N satisfies its condition
+ *
+ * Fences are handled 64 at a time: their current values are loaded first,
+ * then every condition is computed without branches and the result for
+ * each fence is selected by shifting with its op, and finally the results
+ * are packed into the bitmask. The middle loop has no data dependent
+ * control flow, so it can be vectorised, but only when the caller enables
+ * it: GCC 12 keeps it scalar at -O2, with or without -mavx2, and
+ * vectorises it at -O3 (or -O2 -ftree-vectorize
+ * -fvect-cost-model=dynamic) when targeting AVX2 or AVX-512. Without that
+ * it still runs without branches. Results match i915_ufence_check().
+ */
+static inline void
+i915_ufence_array_check(const struct i915_ufence_array *fences, __u64 *done)
+{
+	__u64 cur[64], res[64];
+	__u32 base, i, n;
+
+	for (base = 0; base < fences->count; base += 64) {
+		const __u64 *value = fences->value + base;
+		const __u64 *mask = fences->mask + base;
+		const __u16 *op = fences->op + base;
+		__u64 bits = 0;
+
+		n = fences->count - base < 64 ? fences->count - base : 64;
+		for (i = 0; i < n; i++)
+			cur[i] = __atomic_load_n(fences->ptr[base + i], __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		for (i = 0; i < n; i++) {
+			__u64 a = cur[i] & mask[i], b = value[i] & mask[i];
+			__u64 d = (a - b) & mask[i];
+			__u64 before = d > mask[i] >> 1;
+			__u64 cond;
+
+			/* Bit N holds the result of op PRELIM_I915_UFENCE | N */
+			cond = (__u64)(a == b) << 0 | (__u64)(a != b) << 1 |
+			       (__u64)(a > b) << 2 | (__u64)(a >= b) << 3 |
+			       (__u64)(a < b) << 4 | (__u64)(a <= b) << 5 |
+			       before << 6 | (__u64)(d && !before) << 7;
+			cond &= -(__u64)((op[i] & ~7u) == PRELIM_I915_UFENCE);
+
+			res[i] = cond >> (op[i] & 7) & 1;
+		}
+
+		for (i = 0; i < n; i++)
+			bits |= res[i] << i;
+
+		done[base / 64] = bits;
+	}
+}
+
+/**
+ * typedef i915_ufence_done_fn - Completion callback
+ * @data: &i915_ufence_wait.data
+ * @status: 0 if the fence signalled, -ETIME if its deadline passed
+ */
+typedef void (*i915_ufence_done_fn)(void *data, int status);
+
+/**
+ * typedef i915_ufence_wait_fn - Sleep in the kernel until a fence signals
+ * @ctx: opaque pointer passed to i915_ufence_set_wait()
+ * @wait: argument of %PRELIM_DRM_IOCTL_I915_GEM_WAIT_USER_FENCE
+ *
+ * Return: 0 or -ETIME once @wait is satisfied or timed out, another
+ * negative error code on failure.
+ */
+typedef int (*i915_ufence_wait_fn)(void *ctx,
+				   struct prelim_drm_i915_gem_wait_user_fence *wait);
+
+/**
+ * struct i915_ufence_wait - One fence to wait for
+ */
+struct i915_ufence_wait {
+	/** @ptr: CPU mapping of the fence qword */
+	const __u64 *ptr;
+
+	/** @addr: GPU virtual address of the fence, for the kernel wait */
+	__u64 addr;
+
+	/** @value: &prelim_drm_i915_gem_wait_user_fence.value */
+	__u64 value;
+
+	/** @mask: &prelim_drm_i915_gem_wait_user_fence.mask */
+	__u64 mask;
+
+	/** @deadline: CLOCK_MONOTONIC ns, or %I915_UFENCE_NO_DEADLINE */
+	__s64 deadline;
+
+	/** @ctx_id: Context writing the fence, unused with WAIT_SOFT */
+	__u32 ctx_id;
+
+	/** @op: &prelim_drm_i915_gem_wait_user_fence.op */
+	__u16 op;
+
+	/** @flags: &prelim_drm_i915_gem_wait_user_fence.flags */
+	__u16 flags;
+
+	/** @done: Called once, when the fence completes */
+	i915_ufence_done_fn done;
+
+	/** @data: Passed to @done */
+	void *data;
+};
+
+/**
+ * i915_ufence_signaled - Poll one fence from the CPU
+ * @w: fence to check
+ */
+static inline int
+i915_ufence_signaled(const struct i915_ufence_wait *w)
+{
+	return i915_ufence_check(w->op, __atomic_load_n(w->ptr, __ATOMIC_ACQUIRE),
+				 w->value, w->mask);
+}
+
+/**
+ * i915_ufence_wait_fill - Prepare the kernel wait for one fence
+ * @arg: ioctl argument to fill
+ * @w: fence to wait for
+ * @timeout: absolute CLOCK_MONOTONIC timeout in ns
+ */
+static inline void
+i915_ufence_wait_fill(struct prelim_drm_i915_gem_wait_user_fence *arg,
+		      const struct i915_ufence_wait *w, __s64 timeout)
+{
+	memset(arg, 0, sizeof(*arg));
+	arg->addr = w->addr;
+	arg->ctx_id = w->ctx_id;
+	arg->op = w->op;
+	arg->flags = w->flags | PRELIM_I915_UFENCE_WAIT_ABSTIME;
+	arg->value = w->value;
+	arg->mask = w->mask;
+	arg->timeout = timeout;
+}
+
+/**
+ * struct i915_ufence_set - Fences waited for by one thread
+ */
+struct i915_ufence_set {
+	/** @waits: Caller-owned storage */
+	struct i915_ufence_wait *waits;
+
+	/** @count: Number of pending fences */
+	__u32 count;
+
+	/** @max: Capacity of @waits */
+	__u32 max;
+
+	/** @spin: Current spin budget, in polls */
+	__u32 spin;
+};
+
+static inline void
+i915_ufence_set_init(struct i915_ufence_set *set,
+		     struct i915_ufence_wait *waits, __u32 max)
+{
+	set->waits = waits;
+	set->count = 0;
+	set->max = max;
+	set->spin = I915_UFENCE_SPIN_MIN;
+}
+
+/**
+ * i915_ufence_set_add - Start waiting for a fence
+ * @set: set
+ * @w: fence, copied into the set
+ *
+ * May be called from a completion callback.
+ *
+ * Return: 0 on success, -ENOSPC if the set is full.
+ */
+static inline int
+i915_ufence_set_add(struct i915_ufence_set *set,
+		    const struct i915_ufence_wait *w)
+{
+	if (set->count == set->max)
+		return -ENOSPC;
+
+	set->waits[set->count++] = *w;
+	return 0;
+}
+
+/**
+ * i915_ufence_set_poll - Complete the fences that signalled or expired
+ * @set: set
+ * @now: current CLOCK_MONOTONIC time in ns
+ *
+ * Return: the number of completion callbacks run.
+ */
+static inline __u32
+i915_ufence_set_poll(struct i915_ufence_set *set, __s64 now)
+{
+	__u32 i = 0, done = 0;
+
+	while (i < set->count) {
+		struct i915_ufence_wait w = set->waits[i];
+		int status;
+
+		if (i915_ufence_signaled(&w))
+			status = 0;
+		else if (now >= w.deadline)
+			status = -ETIME;
+		else {
+			i++;
+			continue;
+		}
+
+		/* Remove before the callback, which may add fences */
+		set->waits[i] = set->waits[--set->count];
+		w.done(w.data, status);
+		done++;
+	}
+
+	return done;
+}
+
+static inline void
+__i915_ufence_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/**
+ * i915_ufence_set_wait - Poll, spin, then park until progress is made
+ * @set: set
+ * @now: current CLOCK_MONOTONIC time in ns
+ * @park_ns: longest kernel wait, bounding how late other fences are seen
+ * @fn: kernel wait callback
+ * @ctx: passed to @fn
+ *
+ * Return: the number of completion callbacks run, 0 after parking, or the
+ * negative error code of @fn.
+ */
+static inline int
+i915_ufence_set_wait(struct i915_ufence_set *set, __s64 now, __s64 park_ns,
+		     i915_ufence_wait_fn fn, void *ctx)
+{
+	struct prelim_drm_i915_gem_wait_user_fence arg;
+	const struct i915_ufence_wait *first;
+	__s64 timeout;
+	__u32 i, done;
+	int ret;
+
+	done = i915_ufence_set_poll(set, now);
+	if (done || !set->count)
+		return done;
+
+	for (i = 0; i < set->spin; i++) {
+		__i915_ufence_relax();
+		done = i915_ufence_set_poll(set, now);
+		if (done) {
+			if (set->spin < I915_UFENCE_SPIN_MAX)
+				set->spin *= 2;
+			return done;
+		}
+	}
+	if (set->spin > I915_UFENCE_SPIN_MIN)
+		set->spin /= 2;
+
+	first = &set->waits[0];
+	for (i = 1; i < set->count; i++) {
+		if (set->waits[i].deadline < first->deadline)
+			first = &set->waits[i];
+	}
+
+	timeout = now + park_ns;
+	if (park_ns < 0 || timeout < now || timeout > first->deadline)
+		timeout = first->deadline;
+
+	i915_ufence_wait_fill(&arg, first, timeout);
+	ret = fn(ctx, &arg);
+
+	return ret == -ETIME ? 0 : ret;
+}
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <time.h>
+
+/**
+ * i915_ufence_now - CLOCK_MONOTONIC time in ns, as used with WAIT_ABSTIME
+ */
+static inline __s64
+i915_ufence_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__s64)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+/**
+ * i915_ufence_wait_ioctl - &i915_ufence_wait_fn backed by a DRM fd
+ * @ctx: pointer to an int holding the DRM fd
+ * @wait: wait to submit
+ */
+static inline int
+i915_ufence_wait_ioctl(void *ctx,
+		       struct prelim_drm_i915_gem_wait_user_fence *wait)
+{
+	int fd = *(int *)ctx;
+	int ret;
+
+	do {
+		ret = ioctl(fd, PRELIM_DRM_IOCTL_I915_GEM_WAIT_USER_FENCE, wait);
+	} while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+
+	return ret ? -errno : 0;
+}
+#endif
+
+#endif /* _I915_UFENCE_H_ */
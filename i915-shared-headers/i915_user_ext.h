@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_USER_EXT_H_
+#define _I915_USER_EXT_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "i915_drm.h"
+
+/**
+ * DOC: i915_user_extension chains
+ *
+ * Several ioctls take a singly linked list of struct i915_user_extension
+ * nodes, each embedded at the start of a larger extension struct. The chain
+ * builder below links caller-owned nodes, usually on the stack, in the order
+ * they are added, so building a chain never allocates:
+ *
+ *   .. code:: c
+ *
+ *      struct prelim_drm_i915_gem_create_ext create = { .size = size };
+ *      struct prelim_drm_i915_gem_create_ext_setparam regions = { ... };
+ *      struct prelim_drm_i915_gem_create_ext_memory_policy policy = { ... };
+ *      struct i915_user_ext_chain chain;
+ *
+ *      i915_user_ext_chain_init(&chain, I915_USER_EXT_GEM_CREATE,
+ *                               &create.extensions);
+ *      I915_USER_EXT_CHAIN_ADD(&chain, &regions,
+ *                              PRELIM_I915_GEM_CREATE_EXT_SETPARAM);
+ *      I915_USER_EXT_CHAIN_ADD(&chain, &policy,
+ *                              PRELIM_I915_GEM_CREATE_EXT_MEMORY_POLICY);
+ *
+ * Extension names are only unique within the ioctl that embeds them, so a
+ * chain is tied to one &enum i915_user_ext_ns and rejects names that do
+ * not belong to it. I915_USER_EXT_CHAIN_ADD() additionally checks at compile
+ * time that the node embeds struct i915_user_extension as its first member
+ * named base.
+ *
+ * For execbuffer2 the head is &drm_i915_gem_execbuffer2.cliprects_ptr and
+ * %I915_EXEC_USE_EXTENSIONS must be set in the flags.
+ */
+
+/**
+ * enum i915_user_ext_ns - uAPI that embeds an extension chain
+ */
+enum i915_user_ext_ns {
+	/** @I915_USER_EXT_GEM_CREATE: &prelim_drm_i915_gem_create_ext */
+	I915_USER_EXT_GEM_CREATE,
+	/** @I915_USER_EXT_CONTEXT_CREATE: &drm_i915_gem_context_create_ext */
+	I915_USER_EXT_CONTEXT_CREATE,
+	/** @I915_USER_EXT_CONTEXT_ENGINES: &i915_context_param_engines */
+	I915_USER_EXT_CONTEXT_ENGINES,
+	/** @I915_USER_EXT_EXECBUFFER: &drm_i915_gem_execbuffer2 */
+	I915_USER_EXT_EXECBUFFER,
+	/** @I915_USER_EXT_VM_BIND: &prelim_drm_i915_gem_vm_bind */
+	I915_USER_EXT_VM_BIND,
+	/** @I915_USER_EXT_VM_CONTROL: &drm_i915_gem_vm_control */
+	I915_USER_EXT_VM_CONTROL,
+};
+
+/**
+ * i915_user_ext_valid - Check that a name is known within a namespace
+ * @ns: uAPI that embeds the chain
+ * @name: &i915_user_extension.name
+ */
+static inline int
+i915_user_ext_valid(enum i915_user_ext_ns ns, __u32 name)
+{
+	switch (ns) {
+	case I915_USER_EXT_GEM_CREATE:
+		return name == I915_GEM_CREATE_EXT_MEMORY_REGIONS ||
+		       name == I915_GEM_CREATE_EXT_PROTECTED_CONTENT ||
+		       name == PRELIM_I915_GEM_CREATE_EXT_SETPARAM ||
+		       name == PRELIM_I915_GEM_CREATE_EXT_PROTECTED_CONTENT ||
+		       name == PRELIM_I915_GEM_CREATE_EXT_VM_PRIVATE ||
+		       name == PRELIM_I915_GEM_CREATE_EXT_MEMORY_POLICY;
+	case I915_USER_EXT_CONTEXT_CREATE:
+		/* PRELIM_I915_CONTEXT_CREATE_EXT_CLONE has been removed */
+		return name == I915_CONTEXT_CREATE_EXT_SETPARAM;
+	case I915_USER_EXT_CONTEXT_ENGINES:
+		return name == I915_CONTEXT_ENGINES_EXT_LOAD_BALANCE ||
+		       name == I915_CONTEXT_ENGINES_EXT_BOND ||
+		       name == I915_CONTEXT_ENGINES_EXT_PARALLEL_SUBMIT ||
+		       name == PRELIM_I915_CONTEXT_ENGINES_EXT_PARALLEL_SUBMIT ||
+		       name == PRELIM_I915_CONTEXT_ENGINES_EXT_PARALLEL2_SUBMIT;
+	case I915_USER_EXT_EXECBUFFER:
+		return name == DRM_I915_GEM_EXECBUFFER_EXT_TIMELINE_FENCES ||
+		       name == PRELIM_DRM_I915_GEM_EXECBUFFER_EXT_USER_FENCE;
+	case I915_USER_EXT_VM_BIND:
+		return name == PRELIM_I915_VM_BIND_EXT_SYNC_FENCE ||
+		       name == PRELIM_I915_VM_BIND_EXT_UUID ||
+		       name == PRELIM_I915_VM_BIND_EXT_SET_PAT ||
+		       name == PRELIM_I915_VM_BIND_EXT_USER_FENCE;
+	case I915_USER_EXT_VM_CONTROL:
+		return name == PRELIM_I915_GEM_VM_CONTROL_EXT_REGION;
+	}
+
+	return 0;
+}
+
+/**
+ * struct i915_user_ext_chain - Builder for one extension chain
+ */
+struct i915_user_ext_chain {
+	/** @link: Where the address of the next node is stored */
+	void *link;
+
+	/** @ns: uAPI the chain belongs to */
+	enum i915_user_ext_ns ns;
+
+	/** @count: Number of nodes linked so far */
+	__u32 count;
+};
+
+/**
+ * i915_user_ext_chain_init - Start a chain
+ * @chain: builder to initialise
+ * @ns: uAPI that embeds the chain
+ * @head: extensions field of the ioctl argument, cleared here
+ */
+static inline void
+i915_user_ext_chain_init(struct i915_user_ext_chain *chain,
+			 enum i915_user_ext_ns ns, __u64 *head)
+{
+	*head = 0;
+	chain->link = head;
+	chain->ns = ns;
+	chain->count = 0;
+}
+
+/**
+ * i915_user_ext_chain_add - Append a node to the chain
+ * @chain: builder
+ * @ext: node starting with struct i915_user_extension; must outlive the
+ *	 ioctl call and may be a packed struct
+ * @name: extension name, stored in @ext
+ *
+ * Return: 0 on success, -EINVAL if @name is not valid for the chain.
+ */
+static inline int
+i915_user_ext_chain_add(struct i915_user_ext_chain *chain, void *ext,
+			__u32 name)
+{
+	struct i915_user_extension base;
+	__u64 addr = (uintptr_t)ext;
+
+	if (!i915_user_ext_valid(chain->ns, name))
+		return -EINVAL;
+
+	/* Some extension structs are packed, so never dereference @ext */
+	memcpy(&base, ext, sizeof(base));
+	base.next_extension = 0;
+	base.name = name;
+	memcpy(ext, &base, sizeof(base));
+
+	memcpy(chain->link, &addr, sizeof(addr));
+	chain->link = (__u8 *)ext + offsetof(struct i915_user_extension, next_extension);
+	chain->count++;
+
+	return 0;
+}
+
+/**
+ * I915_USER_EXT_CHAIN_ADD - Append a typed extension struct to a chain
+ * @chain: builder
+ * @ext: pointer to an extension struct whose first member is
+ *	 ``struct i915_user_extension base``
+ * @name: extension name
+ */
+#define I915_USER_EXT_CHAIN_ADD(chain, ext, name) \
+	((void)sizeof(char[1 - 2 * (offsetof(__typeof__(*(ext)), base) != 0)]), \
+	 i915_user_ext_chain_add((chain), (ext), (name)))
+
+/**
+ * i915_user_ext_for_each - Walk a linked extension chain
+ * @ext: struct i915_user_extension cursor
+ * @head: value of the extensions field
+ */
+#define i915_user_ext_for_each(ext, head) \
+	for ((ext) = (struct i915_user_extension *)(uintptr_t)(head); (ext); \
+	     (ext) = (struct i915_user_extension *)(uintptr_t)(ext)->next_extension)
+
+#endif /* _I915_USER_EXT_H_ */
@@ -0,0 +1,320 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_VA_HEAP_H_
+#define _I915_VA_HEAP_H_
+
+#include <errno.h>
+
+#include "i915_drm.h"
+
+/**
+ * DOC: Softpin virtual address heap
+ *
+ * With %I915_PARAM_HAS_EXEC_SOFTPIN userspace chooses the GPU virtual
+ * address of every object itself and passes it in
+ * &drm_i915_gem_exec_object2.offset with %EXEC_OBJECT_PINNED set.
+ *
+ * struct i915_va_heap manages one range of the address space. Free ranges
+ * are kept in segregated lists, one per power of two size class, with a
+ * bitmap of the non-empty classes. Every range also links to its address
+ * neighbours, so freeing coalesces with both neighbours in constant time.
+ * Allocation is a bitmap scan plus a split when a class holds ranges large
+ * enough for any alignment; otherwise the ranges of the smaller classes
+ * are checked one by one, so an aligned range that fits exactly is found. Range descriptors come
+ * from a caller-provided node array, so the heap never allocates.
+ *
+ * A heap is not thread safe. Threads that allocate frequently can each own
+ * a heap over a disjoint sub-range and only fall back to a shared, locked
+ * heap when theirs is exhausted.
+ *
+ * Addresses handled by the heap are plain 48-bit offsets; convert them with
+ * i915_va_canonical() before handing them to the kernel.
+ */
+
+#define I915_VA_NIL		(~0u)
+#define I915_VA_CLASSES		64
+
+/**
+ * i915_va_canonical - Sign extend a 48-bit GPU virtual address
+ * @addr: address with bits 63:48 clear
+ *
+ * The kernel expects softpinned offsets in canonical form, with bit 47
+ * replicated into the upper bits.
+ */
+static inline __u64
+i915_va_canonical(__u64 addr)
+{
+	return (__u64)((__s64)(addr << 16) >> 16);
+}
+
+/**
+ * i915_va_decanonical - Strip the sign extension of a canonical address
+ * @addr: canonical address
+ */
+static inline __u64
+i915_va_decanonical(__u64 addr)
+{
+	return addr & ((1ull << 48) - 1);
+}
+
+/**
+ * i915_exec_object_softpin - Pin an execbuf object at a chosen address
+ * @obj: object to fill
+ * @handle: GEM handle
+ * @addr: 48-bit address from the heap
+ */
+static inline void
+i915_exec_object_softpin(struct drm_i915_gem_exec_object2 *obj, __u32 handle,
+			 __u64 addr)
+{
+	obj->handle = handle;
+	obj->offset = i915_va_canonical(addr);
+	obj->flags |= EXEC_OBJECT_PINNED | EXEC_OBJECT_SUPPORTS_48B_ADDRESS;
+}
+
+/**
+ * struct i915_va_node - Descriptor of one free or allocated range
+ */
+struct i915_va_node {
+	__u64 start;
+	__u64 size;
+
+	/* Address ordered neighbours */
+	__u32 prev;
+	__u32 next;
+
+	/* Size class list, or unused node stack through @free_next */
+	__u32 free_prev;
+	__u32 free_next;
+
+	__u32 state;
+#define I915_VA_NODE_UNUSED	0
+#define I915_VA_NODE_FREE	1
+#define I915_VA_NODE_USED	2
+	__u32 pad;
+};
+
+/**
+ * struct i915_va_heap - Segregated fit allocator over one address range
+ */
+struct i915_va_heap {
+	struct i915_va_node *nodes;
+	__u32 num_nodes;
+
+	/* Head of the unused node stack */
+	__u32 unused;
+
+	/* Bit N set when @free_list[N] is not empty */
+	__u64 class_mask;
+	__u32 free_list[I915_VA_CLASSES];
+};
+
+static inline __u32
+__i915_va_class(__u64 size)
+{
+	return 63 - __builtin_clzll(size);
+}
+
+static inline void
+__i915_va_link_free(struct i915_va_heap *heap, __u32 idx)
+{
+	struct i915_va_node *node = &heap->nodes[idx];
+	__u32 c = __i915_va_class(node->size);
+
+	node->state = I915_VA_NODE_FREE;
+	node->free_prev = I915_VA_NIL;
+	node->free_next = heap->free_list[c];
+	if (node->free_next != I915_VA_NIL)
+		heap->nodes[node->free_next].free_prev = idx;
+	heap->free_list[c] = idx;
+	heap->class_mask |= 1ull << c;
+}
+
+static inline void
+__i915_va_unlink_free(struct i915_va_heap *heap, __u32 idx)
+{
+	struct i915_va_node *node = &heap->nodes[idx];
+	__u32 c = __i915_va_class(node->size);
+
+	if (node->free_prev != I915_VA_NIL)
+		heap->nodes[node->free_prev].free_next = node->free_next;
+	else
+		heap->free_list[c] = node->free_next;
+	if (node->free_next != I915_VA_NIL)
+		heap->nodes[node->free_next].free_prev = node->free_prev;
+
+	if (heap->free_list[c] == I915_VA_NIL)
+		heap->class_mask &= ~(1ull << c);
+}
+
+static inline void
+__i915_va_put_node(struct i915_va_heap *heap, __u32 idx)
+{
+	heap->nodes[idx].state = I915_VA_NODE_UNUSED;
+	heap->nodes[idx].free_next = heap->unused;
+	heap->unused = idx;
+}
+
+/* Split @idx at @offset, the new node describes the upper part */
+static inline __u32
+__i915_va_split(struct i915_va_heap *heap, __u32 idx, __u64 offset)
+{
+	struct i915_va_node *node = &heap->nodes[idx];
+	__u32 tail = heap->unused;
+	struct i915_va_node *t = &heap->nodes[tail];
+
+	heap->unused = t->free_next;
+
+	t->start = node->start + offset;
+	t->size = node->size - offset;
+	t->prev = idx;
+	t->next = node->next;
+	if (node->next != I915_VA_NIL)
+		heap->nodes[node->next].prev = tail;
+	node->next = tail;
+	node->size = offset;
+
+	return tail;
+}
+
+/**
+ * i915_va_heap_init - Manage [@start, @start + @size)
+ * @heap: heap to initialise
+ * @nodes: descriptor storage; one allocation or free range uses one node
+ * @num_nodes: number of entries in @nodes, at least 1
+ * @start: first address of the range
+ * @size: size of the range in bytes
+ */
+static inline void
+i915_va_heap_init(struct i915_va_heap *heap, struct i915_va_node *nodes,
+		  __u32 num_nodes, __u64 start, __u64 size)
+{
+	__u32 i;
+
+	heap->nodes = nodes;
+	heap->num_nodes = num_nodes;
+	heap->class_mask = 0;
+	for (i = 0; i < I915_VA_CLASSES; i++)
+		heap->free_list[i] = I915_VA_NIL;
+
+	heap->unused = I915_VA_NIL;
+	for (i = num_nodes; i-- > 1; )
+		__i915_va_put_node(heap, i);
+
+	nodes[0].start = start;
+	nodes[0].size = size;
+	nodes[0].prev = I915_VA_NIL;
+	nodes[0].next = I915_VA_NIL;
+	__i915_va_link_free(heap, 0);
+}
+
+/* Whether an aligned range of @size fits in free range @node */
+static inline int
+__i915_va_fits(const struct i915_va_node *node, __u64 size, __u64 align)
+{
+	__u64 pad = -node->start & (align - 1);
+
+	return pad < node->size && node->size - pad >= size;
+}
+
+/**
+ * i915_va_heap_alloc - Allocate an aligned range
+ * @heap: heap to allocate from
+ * @size: size in bytes, non zero
+ * @align: power of two alignment, e.g. 4K, 64K for device memory or 2M
+ * @addr: returns the start of the range
+ * @handle: returns the handle to pass to i915_va_heap_free()
+ *
+ * Return: 0 on success, -ENOSPC if no free range can hold the aligned
+ * range or -ENOMEM if the node array is exhausted.
+ */
+static inline int
+i915_va_heap_alloc(struct i915_va_heap *heap, __u64 size, __u64 align,
+		   __u64 *addr, __u32 *handle)
+{
+	__u64 need = size + align - 1, pad, mask;
+	__u32 c = __i915_va_class(need), idx = I915_VA_NIL, spare;
+
+	/* Any range in a class above the one of @need fits whatever its start */
+	if (need & (need - 1))
+		c++;
+	mask = need >= size && c < I915_VA_CLASSES ?
+		heap->class_mask & (~0ull << c) : 0;
+
+	if (mask) {
+		idx = heap->free_list[__builtin_ctzll(mask)];
+	} else {
+		/* Otherwise check the ranges of the smaller classes one by one */
+		mask = heap->class_mask & (~0ull << __i915_va_class(size));
+		for (; mask && idx == I915_VA_NIL; mask &= mask - 1) {
+			for (idx = heap->free_list[__builtin_ctzll(mask)];
+			     idx != I915_VA_NIL &&
+			     !__i915_va_fits(&heap->nodes[idx], size, align);
+			     idx = heap->nodes[idx].free_next)
+				;
+		}
+		if (idx == I915_VA_NIL)
+			return -ENOSPC;
+	}
+
+	pad = -heap->nodes[idx].start & (align - 1);
+	spare = heap->unused == I915_VA_NIL ? 0 :
+		heap->nodes[heap->unused].free_next == I915_VA_NIL ? 1 : 2;
+	if (spare < (__u32)(pad != 0) + (heap->nodes[idx].size - pad > size))
+		return -ENOMEM;
+
+	__i915_va_unlink_free(heap, idx);
+	if (pad) {
+		__u32 body = __i915_va_split(heap, idx, pad);
+
+		__i915_va_link_free(heap, idx);
+		idx = body;
+	}
+	if (heap->nodes[idx].size > size)
+		__i915_va_link_free(heap, __i915_va_split(heap, idx, size));
+
+	heap->nodes[idx].state = I915_VA_NODE_USED;
+	*addr = heap->nodes[idx].start;
+	*handle = idx;
+	return 0;
+}
+
+/**
+ * i915_va_heap_free - Release a range and merge it with free neighbours
+ * @heap: heap the range was allocated from
+ * @handle: handle returned by i915_va_heap_alloc()
+ */
+static inline void
+i915_va_heap_free(struct i915_va_heap *heap, __u32 handle)
+{
+	__u32 idx = handle;
+	struct i915_va_node *node = &heap->nodes[idx];
+	__u32 next = node->next;
+	__u32 prev = node->prev;
+
+	if (next != I915_VA_NIL && heap->nodes[next].state == I915_VA_NODE_FREE) {
+		__i915_va_unlink_free(heap, next);
+		node->size += heap->nodes[next].size;
+		node->next = heap->nodes[next].next;
+		if (node->next != I915_VA_NIL)
+			heap->nodes[node->next].prev = idx;
+		__i915_va_put_node(heap, next);
+	}
+
+	if (prev != I915_VA_NIL && heap->nodes[prev].state == I915_VA_NODE_FREE) {
+		__i915_va_unlink_free(heap, prev);
+		heap->nodes[prev].size += node->size;
+		heap->nodes[prev].next = node->next;
+		if (node->next != I915_VA_NIL)
+			heap->nodes[node->next].prev = prev;
+		__i915_va_put_node(heap, idx);
+		idx = prev;
+	}
+
+	__i915_va_link_free(heap, idx);
+}
+
+#endif /* _I915_VA_HEAP_H_ */
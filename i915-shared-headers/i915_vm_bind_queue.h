@@ -0,0 +1,276 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_VM_BIND_QUEUE_H_
+#define _I915_VM_BIND_QUEUE_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "i915_drm.h"
+
+/**
+ * DOC: Coalescing VM_BIND queue
+ *
+ * Every %PRELIM_DRM_IOCTL_I915_GEM_VM_BIND and %PRELIM_DRM_IOCTL_I915_GEM_VM_UNBIND
+ * call binds or unbinds a single range. struct i915_vm_bind_queue collects
+ * pending operations and reduces them before they reach the kernel:
+ *
+ * - an unbind of exactly the range of a pending bind cancels both, as long
+ *   as no later pending operation touches that range;
+ * - with %I915_VM_BIND_QUEUE_COALESCE, a bind that continues the previous
+ *   pending bind of the same object, in both virtual address and object
+ *   offset, with the same flags and no extensions, is submitted together
+ *   with it.
+ *
+ * The kernel only unbinds a range that exactly matches a bound VMA, and
+ * coalesced binds become a single VMA. Coalescing is therefore opt-in:
+ * only enable it when merged ranges are unbound as a whole, or never
+ * unbound individually (e.g. the VM is destroyed instead). While they are
+ * still queued, coalesced binds keep their original pieces, so an unbind
+ * of one piece, or of a run of consecutive pieces, still cancels exactly
+ * what it covers.
+ *
+ * i915_vm_bind_queue_flush() then submits what is left in order and
+ * chains a single &prelim_drm_i915_vm_bind_ext_user_fence in front of the
+ * extensions of the last operation. Since the kernel completes the binds
+ * of a VM in order, that fence signals completion of the whole batch;
+ * wait for it with %PRELIM_DRM_IOCTL_I915_GEM_WAIT_USER_FENCE or by
+ * polling the fence address.
+ *
+ * Operations are submitted through a callback so the queue can run against
+ * a fake backend that records the op stream.
+ */
+
+/**
+ * typedef i915_vm_bind_ioctl_fn - Submit one bind or unbind
+ * @ctx: opaque pointer passed to i915_vm_bind_queue_flush()
+ * @request: %PRELIM_DRM_IOCTL_I915_GEM_VM_BIND or _VM_UNBIND
+ * @bind: operation to submit
+ *
+ * Return: 0 on success or a negative error code.
+ */
+typedef int (*i915_vm_bind_ioctl_fn)(void *ctx, unsigned long request,
+				     struct prelim_drm_i915_gem_vm_bind *bind);
+
+/**
+ * struct i915_vm_bind_op - One pending operation
+ */
+struct i915_vm_bind_op {
+	/** @bind: Argument of the ioctl */
+	struct prelim_drm_i915_gem_vm_bind bind;
+
+	/** @unbind: Non-zero for %PRELIM_DRM_IOCTL_I915_GEM_VM_UNBIND */
+	__u16 unbind;
+
+	/** @merged: Bind submitted together with the previous operation */
+	__u16 merged;
+
+	__u32 pad;
+};
+
+/**
+ * struct i915_vm_bind_queue - Pending operations in submission order
+ */
+struct i915_vm_bind_queue {
+	/** @ops: Caller-owned operation storage */
+	struct i915_vm_bind_op *ops;
+
+	/** @count: Number of pending operations */
+	__u32 count;
+
+	/** @max: Capacity of @ops */
+	__u32 max;
+
+	/** @flags: I915_VM_BIND_QUEUE_* */
+	__u32 flags;
+#define I915_VM_BIND_QUEUE_COALESCE	(1 << 0)
+
+	__u32 pad;
+
+	/** @fence: User fence attached to the last operation of a flush */
+	struct prelim_drm_i915_vm_bind_ext_user_fence fence;
+};
+
+static inline void
+i915_vm_bind_queue_init(struct i915_vm_bind_queue *q,
+			struct i915_vm_bind_op *ops, __u32 max, __u32 flags)
+{
+	memset(q, 0, sizeof(*q));
+	q->ops = ops;
+	q->max = max;
+	q->flags = flags;
+}
+
+static inline int
+__i915_vm_bind_overlaps(const struct prelim_drm_i915_gem_vm_bind *b,
+			__u32 vm_id, __u64 start, __u64 length)
+{
+	return b->vm_id == vm_id &&
+	       b->start < start + length && start < b->start + b->length;
+}
+
+/**
+ * i915_vm_bind_queue_bind - Queue a bind
+ * @q: queue
+ * @bind: bind to queue; its extensions are submitted with it
+ *
+ * Return: 0 on success, -ENOSPC if the queue is full.
+ */
+static inline int
+i915_vm_bind_queue_bind(struct i915_vm_bind_queue *q,
+			const struct prelim_drm_i915_gem_vm_bind *bind)
+{
+	__u16 merged = 0;
+
+	if (q->count == q->max)
+		return -ENOSPC;
+
+	if (q->count && q->flags & I915_VM_BIND_QUEUE_COALESCE) {
+		const struct i915_vm_bind_op *last = &q->ops[q->count - 1];
+
+		merged = !last->unbind &&
+			 !last->bind.extensions && !bind->extensions &&
+			 last->bind.vm_id == bind->vm_id &&
+			 last->bind.handle == bind->handle &&
+			 last->bind.flags == bind->flags &&
+			 last->bind.start + last->bind.length == bind->start &&
+			 last->bind.offset + last->bind.length == bind->offset;
+	}
+
+	q->ops[q->count].bind = *bind;
+	q->ops[q->count].unbind = 0;
+	q->ops[q->count].merged = merged;
+	q->count++;
+	return 0;
+}
+
+/* Drop ops [first, last], the op after them no longer continues a run */
+static inline void
+__i915_vm_bind_queue_remove(struct i915_vm_bind_queue *q, __u32 first,
+			    __u32 last)
+{
+	memmove(&q->ops[first], &q->ops[last + 1],
+		(q->count - last - 1) * sizeof(q->ops[0]));
+	q->count -= last - first + 1;
+	if (first < q->count)
+		q->ops[first].merged = 0;
+}
+
+/**
+ * i915_vm_bind_queue_unbind - Queue an unbind, or cancel pending binds
+ * @q: queue
+ * @vm_id: VM to unbind from
+ * @start: start of the range
+ * @length: length of the range
+ *
+ * A pending bind of exactly the range is cancelled, and so is a run of
+ * coalesced binds that together cover exactly the range. Binds with
+ * extensions are never cancelled, since their user fence or syncobj must
+ * still be signalled; the unbind is queued after them instead.
+ *
+ * Return: 0 on success, -ENOSPC if the queue is full.
+ */
+static inline int
+i915_vm_bind_queue_unbind(struct i915_vm_bind_queue *q, __u32 vm_id,
+			  __u64 start, __u64 length)
+{
+	__u32 i, j, k;
+
+	for (i = q->count; i-- > 0; ) {
+		struct i915_vm_bind_op *op = &q->ops[i];
+
+		if (!__i915_vm_bind_overlaps(&op->bind, vm_id, start, length))
+			continue;
+
+		/* The latest op touching the range must end it */
+		if (op->unbind || op->bind.start + op->bind.length != start + length)
+			break;
+
+		/* Walk back over the pieces of a run to the start of the range */
+		for (j = i; q->ops[j].bind.start != start; j--) {
+			if (!q->ops[j].merged || q->ops[j].bind.start < start)
+				break;
+		}
+		if (q->ops[j].bind.start != start)
+			break;
+
+		/* A cancelled bind would never signal its fence or syncobj */
+		for (k = j; k <= i && !q->ops[k].bind.extensions; k++)
+			;
+		if (k <= i)
+			break;
+
+		__i915_vm_bind_queue_remove(q, j, i);
+		return 0;
+	}
+
+	if (q->count == q->max)
+		return -ENOSPC;
+
+	memset(&q->ops[q->count], 0, sizeof(q->ops[0]));
+	q->ops[q->count].bind.vm_id = vm_id;
+	q->ops[q->count].bind.start = start;
+	q->ops[q->count].bind.length = length;
+	q->ops[q->count].unbind = 1;
+	q->count++;
+	return 0;
+}
+
+/**
+ * i915_vm_bind_queue_flush - Submit all pending operations
+ * @q: queue
+ * @fn: ioctl callback
+ * @ctx: passed to @fn
+ * @fence_addr: qword aligned address written when the batch completes,
+ *		or 0 for no fence
+ * @fence_val: value written to @fence_addr
+ *
+ * @q->fence must stay valid until the last operation has been submitted,
+ * which is the case when the queue itself is still alive. The queued
+ * operations are not modified, so a failed flush can be retried.
+ *
+ * Return: 0 on success. On error the failed operation, with all of its
+ * coalesced pieces, and the ones after it stay queued and the negative
+ * error code is returned.
+ */
+static inline int
+i915_vm_bind_queue_flush(struct i915_vm_bind_queue *q,
+			 i915_vm_bind_ioctl_fn fn, void *ctx,
+			 __u64 fence_addr, __u64 fence_val)
+{
+	__u32 i, next;
+	int ret = 0;
+
+	for (i = 0; i < q->count; i = next) {
+		const struct i915_vm_bind_op *op = &q->ops[i];
+		struct prelim_drm_i915_gem_vm_bind bind = op->bind;
+
+		for (next = i + 1; next < q->count && q->ops[next].merged; next++)
+			bind.length += q->ops[next].bind.length;
+
+		if (fence_addr && next == q->count) {
+			memset(&q->fence, 0, sizeof(q->fence));
+			q->fence.base.name = PRELIM_I915_VM_BIND_EXT_USER_FENCE;
+			q->fence.base.next_extension = bind.extensions;
+			q->fence.addr = fence_addr;
+			q->fence.val = fence_val;
+			bind.extensions = (uintptr_t)&q->fence;
+		}
+
+		ret = fn(ctx, op->unbind ? PRELIM_DRM_IOCTL_I915_GEM_VM_UNBIND :
+					   PRELIM_DRM_IOCTL_I915_GEM_VM_BIND,
+			 &bind);
+		if (ret)
+			break;
+	}
+
+	memmove(q->ops, q->ops + i, (q->count - i) * sizeof(q->ops[0]));
+	q->count -= i;
+	return ret;
+}
+
+#endif /* _I915_VM_BIND_QUEUE_H_ */
@@ -0,0 +1,350 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _I915_VM_MIRROR_H_
+#define _I915_VM_MIRROR_H_
+
+#include <errno.h>
+#include <stddef.h>
+
+#include "i915_drm.h"
+
+/**
+ * DOC: VM_BIND mirror
+ *
+ * struct i915_vm_mirror keeps a userspace copy of what has been bound into
+ * one VM with %PRELIM_DRM_IOCTL_I915_GEM_VM_BIND, so questions such as
+ * "what is bound at this address" or "which binds overlap this range",
+ * asked before a vm_advise or vm_prefetch, need neither an ioctl nor a scan.
+ *
+ * Binds within a VM never overlap, so the mirror is a search tree ordered
+ * by start address: a point lookup is O(log n) and an overlap query is
+ * O(log n + k) for k results. The tree is a treap whose priorities are a
+ * hash of the start address, which keeps it balanced in expectation while
+ * staying deterministic. Nodes come from a caller-provided array.
+ *
+ * Updates must be serialised by the caller. Readers on other threads may
+ * run concurrently with an update and detect it through a sequence count:
+ *
+ *   .. code:: c
+ *
+ *      do {
+ *              seq = i915_vm_mirror_read_begin(mirror);
+ *              n = i915_vm_mirror_snapshot(mirror, start, length, out, max);
+ *      } while (i915_vm_mirror_read_retry(mirror, seq));
+ *
+ * Reader walks are bounded by the node count, so a racing update can make
+ * a reader retry but never loop forever.
+ */
+
+#define I915_VM_MIRROR_NIL	(~0u)
+
+/**
+ * struct i915_vm_mirror_entry - One mirrored bind
+ */
+struct i915_vm_mirror_entry {
+	/** @start: &prelim_drm_i915_gem_vm_bind.start */
+	__u64 start;
+
+	/** @length: &prelim_drm_i915_gem_vm_bind.length */
+	__u64 length;
+
+	/** @offset: &prelim_drm_i915_gem_vm_bind.offset */
+	__u64 offset;
+
+	/**
+	 * @flags: &prelim_drm_i915_gem_vm_bind.flags, e.g.
+	 * %PRELIM_I915_GEM_VM_BIND_READONLY or %PRELIM_I915_GEM_VM_BIND_FD
+	 */
+	__u64 flags;
+
+	/** @handle: BO handle, or fd with %PRELIM_I915_GEM_VM_BIND_FD */
+	__u32 handle;
+};
+
+struct i915_vm_mirror_node {
+	struct i915_vm_mirror_entry entry;
+	__u32 prio;
+	__u32 left;
+	__u32 right;
+};
+
+/**
+ * struct i915_vm_mirror - Bind tree of one VM
+ */
+struct i915_vm_mirror {
+	/** @vm_id: VM being mirrored */
+	__u32 vm_id;
+
+	/** @seq: Odd while an update is in progress */
+	__u32 seq;
+
+	__u32 root;
+	__u32 unused;
+	__u32 count;
+	__u32 num_nodes;
+	struct i915_vm_mirror_node *nodes;
+};
+
+static inline void
+i915_vm_mirror_init(struct i915_vm_mirror *m, __u32 vm_id,
+		    struct i915_vm_mirror_node *nodes, __u32 num_nodes)
+{
+	__u32 i;
+
+	m->vm_id = vm_id;
+	m->seq = 0;
+	m->root = I915_VM_MIRROR_NIL;
+	m->count = 0;
+	m->num_nodes = num_nodes;
+	m->nodes = nodes;
+
+	m->unused = I915_VM_MIRROR_NIL;
+	for (i = num_nodes; i-- > 0; ) {
+		nodes[i].left = m->unused;
+		m->unused = i;
+	}
+}
+
+static inline __u32
+__i915_vm_mirror_prio(__u64 start)
+{
+	start ^= start >> 33;
+	start *= 0xff51afd7ed558ccdull;
+	start ^= start >> 33;
+	return (__u32)start;
+}
+
+/* Split @t into nodes starting below @key and the rest */
+static inline void
+__i915_vm_mirror_split(struct i915_vm_mirror_node *n, __u32 t, __u64 key,
+		       __u32 *l, __u32 *r)
+{
+	if (t == I915_VM_MIRROR_NIL) {
+		*l = *r = I915_VM_MIRROR_NIL;
+	} else if (n[t].entry.start < key) {
+		__i915_vm_mirror_split(n, n[t].right, key, &n[t].right, r);
+		*l = t;
+	} else {
+		__i915_vm_mirror_split(n, n[t].left, key, l, &n[t].left);
+		*r = t;
+	}
+}
+
+static inline __u32
+__i915_vm_mirror_merge(struct i915_vm_mirror_node *n, __u32 a, __u32 b)
+{
+	if (a == I915_VM_MIRROR_NIL)
+		return b;
+	if (b == I915_VM_MIRROR_NIL)
+		return a;
+
+	if (n[a].prio > n[b].prio) {
+		n[a].right = __i915_vm_mirror_merge(n, n[a].right, b);
+		return a;
+	}
+
+	n[b].left = __i915_vm_mirror_merge(n, a, n[b].left);
+	return b;
+}
+
+/**
+ * i915_vm_mirror_find - Look up the bind containing an address
+ * @m: mirror
+ * @addr: virtual address
+ *
+ * Return: the entry, or NULL if nothing is bound at @addr.
+ */
+static inline const struct i915_vm_mirror_entry *
+i915_vm_mirror_find(const struct i915_vm_mirror *m, __u64 addr)
+{
+	const struct i915_vm_mirror_entry *best = NULL;
+	__u32 t = m->root, steps = 0;
+
+	while (t != I915_VM_MIRROR_NIL && steps++ < m->num_nodes) {
+		const struct i915_vm_mirror_node *node = &m->nodes[t];
+
+		if (node->entry.start <= addr) {
+			best = &node->entry;
+			t = node->right;
+		} else {
+			t = node->left;
+		}
+	}
+
+	if (best && addr - best->start < best->length)
+		return best;
+
+	return NULL;
+}
+
+/* Binds are disjoint, so only the last one starting below @end can overlap */
+static inline int
+__i915_vm_mirror_range_free(const struct i915_vm_mirror *m, __u64 start,
+			    __u64 end)
+{
+	const struct i915_vm_mirror_entry *last = NULL;
+	__u32 t = m->root;
+
+	while (t != I915_VM_MIRROR_NIL) {
+		const struct i915_vm_mirror_node *node = &m->nodes[t];
+
+		if (node->entry.start < end) {
+			last = &node->entry;
+			t = node->right;
+		} else {
+			t = node->left;
+		}
+	}
+
+	return !last || last->start + last->length <= start;
+}
+
+/**
+ * i915_vm_mirror_bind - Record a successful bind
+ * @m: mirror
+ * @bind: argument of the bind ioctl
+ *
+ * Return: 0 on success, -EINVAL if @bind targets another VM, -EEXIST if
+ * the range overlaps a mirrored bind, -ENOMEM if the node array is
+ * exhausted.
+ */
+static inline int
+i915_vm_mirror_bind(struct i915_vm_mirror *m,
+		    const struct prelim_drm_i915_gem_vm_bind *bind)
+{
+	struct i915_vm_mirror_node *n = m->nodes;
+	__u32 idx, l, r;
+
+	if (bind->vm_id != m->vm_id)
+		return -EINVAL;
+	if (!__i915_vm_mirror_range_free(m, bind->start,
+					 bind->start + bind->length))
+		return -EEXIST;
+	if (m->unused == I915_VM_MIRROR_NIL)
+		return -ENOMEM;
+
+	__atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	idx = m->unused;
+	m->unused = n[idx].left;
+	n[idx].entry.start = bind->start;
+	n[idx].entry.length = bind->length;
+	n[idx].entry.offset = bind->offset;
+	n[idx].entry.flags = bind->flags;
+	n[idx].entry.handle = bind->handle;
+	n[idx].prio = __i915_vm_mirror_prio(bind->start);
+	n[idx].left = n[idx].right = I915_VM_MIRROR_NIL;
+
+	__i915_vm_mirror_split(n, m->root, bind->start, &l, &r);
+	m->root = __i915_vm_mirror_merge(n, __i915_vm_mirror_merge(n, l, idx), r);
+	m->count++;
+
+	__atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * i915_vm_mirror_unbind - Record a successful unbind
+ * @m: mirror
+ * @start: &prelim_drm_i915_gem_vm_bind.start of the unbind
+ * @length: &prelim_drm_i915_gem_vm_bind.length of the unbind
+ *
+ * Return: 0 on success, -ENOENT if no mirrored bind matches the range.
+ */
+static inline int
+i915_vm_mirror_unbind(struct i915_vm_mirror *m, __u64 start, __u64 length)
+{
+	struct i915_vm_mirror_node *n = m->nodes;
+	__u32 l, mid, r;
+	int ret = -ENOENT;
+
+	__atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__i915_vm_mirror_split(n, m->root, start, &l, &mid);
+	__i915_vm_mirror_split(n, mid, start + 1, &mid, &r);
+
+	if (mid != I915_VM_MIRROR_NIL && n[mid].entry.length == length) {
+		n[mid].left = m->unused;
+		m->unused = mid;
+		m->count--;
+		mid = I915_VM_MIRROR_NIL;
+		ret = 0;
+	}
+	m->root = __i915_vm_mirror_merge(n, __i915_vm_mirror_merge(n, l, mid), r);
+
+	__atomic_store_n(&m->seq, m->seq + 1, __ATOMIC_RELEASE);
+	return ret;
+}
+
+static inline __u32
+__i915_vm_mirror_collect(const struct i915_vm_mirror *m, __u32 t,
+			 __u64 start, __u64 end,
+			 struct i915_vm_mirror_entry *out, __u32 max,
+			 __u32 count, __u32 *budget)
+{
+	while (t != I915_VM_MIRROR_NIL && *budget) {
+		const struct i915_vm_mirror_node *node = &m->nodes[t];
+
+		(*budget)--;
+		if (node->entry.start >= end) {
+			t = node->left;
+		} else if (node->entry.start + node->entry.length <= start) {
+			t = node->right;
+		} else {
+			count = __i915_vm_mirror_collect(m, node->left, start, end,
+							 out, max, count, budget);
+			if (count < max)
+				out[count] = node->entry;
+			count++;
+			t = node->right;
+		}
+	}
+
+	return count;
+}
+
+/**
+ * i915_vm_mirror_snapshot - Copy out the binds overlapping a range
+ * @m: mirror
+ * @start: start of the range
+ * @length: length of the range, ~0ull - @start for everything above @start
+ * @out: destination, in increasing address order
+ * @max: capacity of @out
+ *
+ * Return: the number of overlapping binds, which may exceed @max.
+ */
+static inline __u32
+i915_vm_mirror_snapshot(const struct i915_vm_mirror *m, __u64 start,
+			__u64 length, struct i915_vm_mirror_entry *out,
+			__u32 max)
+{
+	__u32 budget = m->num_nodes;
+
+	return __i915_vm_mirror_collect(m, m->root, start, start + length,
+					out, max, 0, &budget);
+}
+
+static inline __u32
+i915_vm_mirror_read_begin(const struct i915_vm_mirror *m)
+{
+	__u32 seq;
+
+	while ((seq = __atomic_load_n(&m->seq, __ATOMIC_ACQUIRE)) & 1)
+		;
+
+	return seq;
+}
+
+static inline int
+i915_vm_mirror_read_retry(const struct i915_vm_mirror *m, __u32 seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&m->seq, __ATOMIC_RELAXED) != seq;
+}
+
+#endif /* _I915_VM_MIRROR_H_ */
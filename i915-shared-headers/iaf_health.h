@@ -0,0 +1,577 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _IAF_HEALTH_H_
+#define _IAF_HEALTH_H_
+
+#include <errno.h>
+#include <string.h>
+
+#include "iaf_nl_codec.h"
+
+/**
+ * DOC: Incremental fabric port health
+ *
+ * The firmware counts port traps per sub-device. Reading those counters
+ * with %IAF_CMD_OP_SUB_DEVICE_TRAP_COUNT_QUERY is one small request per
+ * sub-device, while %IAF_CMD_OP_FPORT_STATUS_QUERY returns every status
+ * attribute of every port. struct iaf_health therefore polls in two
+ * phases:
+ *
+ * 1. iaf_health_encode_traps() asks every sub-device for its trap counters,
+ *    and iaf_health_decode_traps() marks the sub-devices whose counters
+ *    moved since the last poll as dirty.
+ * 2. iaf_health_encode_status() asks for the port status of the dirty
+ *    sub-devices only, and iaf_health_decode_status() updates their ports.
+ *
+ * Every sub-device starts dirty. In steady state, with no trap, a poll
+ * costs one trap count request per sub-device and no status request.
+ *
+ * Each port keeps its &enum iaf_fport_health and a mask of the
+ * %IAF_ATTR_FPORT_ISSUE_* and %IAF_ATTR_FPORT_ERROR_* flags. A change of
+ * either is a transition: it is stamped with the caller's clock and passed
+ * to the optional &iaf_health.transition callback.
+ *
+ * Requests of a phase use consecutive sequence numbers starting at the one
+ * given, and replies are matched by sequence number as in
+ * struct iaf_tp_sampler.
+ */
+
+#define IAF_HEALTH_MAX_MSGS	256
+
+#define IAF_HEALTH_ISSUE_LQI		(1 << 0)
+#define IAF_HEALTH_ISSUE_LWD		(1 << 1)
+#define IAF_HEALTH_ISSUE_RATE		(1 << 2)
+#define IAF_HEALTH_ERROR_FAILED		(1 << 3)
+#define IAF_HEALTH_ERROR_ISOLATED	(1 << 4)
+#define IAF_HEALTH_ERROR_FLAPPING	(1 << 5)
+#define IAF_HEALTH_ERROR_LINK_DOWN	(1 << 6)
+#define IAF_HEALTH_ERROR_DID_NOT_TRAIN	(1 << 7)
+
+/**
+ * struct iaf_health_port - Health of one port
+ */
+struct iaf_health_port {
+	__u8 port;
+
+	/** @health: &enum iaf_fport_health */
+	__u8 health;
+
+	/** @flags: IAF_HEALTH_ISSUE_* and IAF_HEALTH_ERROR_* */
+	__u16 flags;
+
+	/** @lqi: %IAF_ATTR_FPORT_LINK_QUALITY_INDICATOR */
+	__u8 lqi;
+
+	/** @primed: A status has been read */
+	__u8 primed;
+
+	__u16 pad;
+
+	/** @since: Time of the last transition, or of the first reading */
+	__u64 since;
+
+	/** @transitions: Transitions seen so far */
+	__u64 transitions;
+};
+
+#define IAF_HEALTH_NUM_TRAPS	5
+
+/**
+ * struct iaf_health_sd - One sub-device and its ports
+ */
+struct iaf_health_sd {
+	__u32 fabric_id;
+	__u8 sd_index;
+
+	/** @dirty: Port status must be re-read */
+	__u8 dirty;
+
+	__u16 pad;
+
+	/** @traps: Last IAF_ATTR_SUB_DEVICE_PORT_*_TRAP_COUNT values */
+	__u64 traps[IAF_HEALTH_NUM_TRAPS];
+
+	struct iaf_health_port *ports;
+	__u32 num_ports;
+	__u32 pad2;
+};
+
+/**
+ * typedef iaf_health_transition_fn - Port health or flags changed
+ * @data: &iaf_health.data
+ * @sd: sub-device of the port
+ * @port: port, already updated
+ * @old_health: previous &enum iaf_fport_health
+ * @old_flags: previous flags
+ */
+typedef void (*iaf_health_transition_fn)(void *data,
+					 const struct iaf_health_sd *sd,
+					 const struct iaf_health_port *port,
+					 __u8 old_health, __u16 old_flags);
+
+/**
+ * struct iaf_health - Monitor state
+ */
+struct iaf_health {
+	struct iaf_health_sd *sds;
+	__u32 num_sds;
+	__u16 family;
+	__u16 pad;
+
+	iaf_health_transition_fn transition;
+	void *data;
+
+	/** @seq: First sequence number of the current phase */
+	__u32 seq;
+
+	/** @num_msgs: Requests in the current phase */
+	__u32 num_msgs;
+
+	/** @pending: Requests of the phase without a reply yet */
+	__u32 pending;
+
+	__u32 pad2;
+
+	/** @trap_queries: Trap count requests sent */
+	__u64 trap_queries;
+
+	/** @status_queries: Port status requests sent */
+	__u64 status_queries;
+
+	/** @errors: Failed or malformed replies */
+	__u64 errors;
+
+	/** @stale: Replies not matching a pending request */
+	__u64 stale;
+
+	/** @msg_sd: Sub-device of each request of the phase */
+	__u16 msg_sd[IAF_HEALTH_MAX_MSGS];
+};
+
+/**
+ * iaf_health_init - Initialise a monitor
+ * @h: monitor
+ * @sds: sub-devices, with @fabric_id, @sd_index, @ports and @num_ports set
+ *	 and the port numbers filled in
+ * @num_sds: number of entries in @sds, at most %IAF_HEALTH_MAX_MSGS
+ * @family: IAF family id
+ * @transition: called on every transition, may be NULL
+ * @data: passed to @transition
+ *
+ * Return: 0 on success or -E2BIG.
+ */
+static inline int
+iaf_health_init(struct iaf_health *h, struct iaf_health_sd *sds,
+		__u32 num_sds, __u16 family,
+		iaf_health_transition_fn transition, void *data)
+{
+	__u32 i, j;
+
+	if (num_sds > IAF_HEALTH_MAX_MSGS)
+		return -E2BIG;
+
+	memset(h, 0, sizeof(*h));
+	h->sds = sds;
+	h->num_sds = num_sds;
+	h->family = family;
+	h->transition = transition;
+	h->data = data;
+
+	for (i = 0; i < num_sds; i++) {
+		sds[i].dirty = 1;
+		memset(sds[i].traps, 0, sizeof(sds[i].traps));
+		for (j = 0; j < sds[i].num_ports; j++)
+			sds[i].ports[j].primed = 0;
+	}
+
+	return 0;
+}
+
+/* Start a phase, the requests are added with __iaf_health_msg() */
+static inline void
+__iaf_health_phase(struct iaf_health *h, __u32 seq)
+{
+	h->seq = seq;
+	h->num_msgs = 0;
+	h->pending = 0;
+}
+
+/* Match a reply to a request of the phase, returns the sub-device */
+static inline struct iaf_health_sd *
+__iaf_health_match(struct iaf_health *h, const struct nlmsghdr *nlh)
+{
+	__u32 idx = nlh->nlmsg_seq - h->seq;
+	struct iaf_health_sd *sd;
+
+	if (idx >= h->num_msgs || h->msg_sd[idx] == 0xffff) {
+		h->stale++;
+		return NULL;
+	}
+
+	sd = &h->sds[h->msg_sd[idx]];
+	h->msg_sd[idx] = 0xffff;
+	h->pending--;
+
+	return sd;
+}
+
+/**
+ * iaf_health_encode_traps - Encode phase 1
+ * @h: monitor
+ * @buf: destination, 4-byte aligned
+ * @size: size of @buf
+ * @seq: first sequence number
+ *
+ * Return: the number of bytes to send, or -EMSGSIZE.
+ */
+static inline int
+iaf_health_encode_traps(struct iaf_health *h, void *buf, __u32 size, __u32 seq)
+{
+	__u32 len = 0, i;
+
+	__iaf_health_phase(h, seq);
+
+	for (i = 0; i < h->num_sds; i++) {
+		struct iaf_nl_msg msg;
+		int ret;
+
+		iaf_nl_msg_init(&msg, (__u8 *)buf + len, size - len, h->family,
+				IAF_CMD_OP_SUB_DEVICE_TRAP_COUNT_QUERY,
+				seq + i, i);
+		iaf_nl_put_sd(&msg, h->sds[i].fabric_id, h->sds[i].sd_index);
+		ret = iaf_nl_msg_finish(&msg);
+		if (ret < 0)
+			return ret;
+
+		len += ret;
+		h->msg_sd[h->num_msgs++] = i;
+	}
+	h->pending = h->num_msgs;
+	h->trap_queries += h->num_msgs;
+
+	return len;
+}
+
+/**
+ * iaf_health_decode_traps - Consume phase 1 replies
+ * @h: monitor
+ * @buf: received data, 4-byte aligned
+ * @len: number of bytes in @buf
+ *
+ * A sub-device whose trap counters moved, or whose reply failed, becomes
+ * dirty.
+ *
+ * Return: the number of sub-devices that became dirty, or -EBADMSG.
+ */
+static inline int
+iaf_health_decode_traps(struct iaf_health *h, const void *buf, __u32 len)
+{
+	const struct nlmsghdr *nlh;
+	__u32 off = 0;
+	int dirtied = 0;
+
+	while ((nlh = iaf_nl_msg_next(buf, len, &off))) {
+		struct iaf_health_sd *sd = __iaf_health_match(h, nlh);
+		__u64 traps[IAF_HEALTH_NUM_TRAPS];
+		struct iaf_nl_reply reply;
+		struct iaf_nl_iter it;
+		struct iaf_nl_attr attr;
+		int have = 0;
+
+		if (!sd)
+			continue;
+
+		if (iaf_nl_reply_parse(nlh, &reply)) {
+			h->errors++;
+			dirtied += !sd->dirty;
+			sd->dirty = 1;
+			continue;
+		}
+
+		memcpy(traps, sd->traps, sizeof(traps));
+		iaf_nl_iter_init(&it, reply.attrs, reply.attrs_len);
+		while (iaf_nl_iter_next(&it, &attr) > 0) {
+			__u32 t = attr.type - IAF_ATTR_SUB_DEVICE_PORT_STATE_CHANGE_TRAP_COUNT;
+
+			if (t < IAF_HEALTH_NUM_TRAPS) {
+				traps[t] = iaf_nl_attr_uint(&attr);
+				have++;
+			}
+		}
+		if (!have)
+			h->errors++;
+
+		if (!have || memcmp(traps, sd->traps, sizeof(traps))) {
+			memcpy(sd->traps, traps, sizeof(traps));
+			dirtied += !sd->dirty;
+			sd->dirty = 1;
+		}
+	}
+
+	return off == len ? dirtied : -EBADMSG;
+}
+
+/**
+ * iaf_health_encode_status - Encode phase 2
+ * @h: monitor
+ * @buf: destination, 4-byte aligned
+ * @size: size of @buf
+ * @seq: first sequence number
+ *
+ * Return: the number of bytes to send, 0 if no sub-device is dirty, or
+ * -EMSGSIZE.
+ */
+static inline int
+iaf_health_encode_status(struct iaf_health *h, void *buf, __u32 size, __u32 seq)
+{
+	__u32 len = 0, i, j;
+
+	__iaf_health_phase(h, seq);
+
+	for (i = 0; i < h->num_sds; i++) {
+		struct iaf_health_sd *sd = &h->sds[i];
+		struct iaf_nl_msg msg;
+		int ret;
+
+		if (!sd->dirty || !sd->num_ports)
+			continue;
+
+		iaf_nl_msg_init(&msg, (__u8 *)buf + len, size - len, h->family,
+				IAF_CMD_OP_FPORT_STATUS_QUERY,
+				seq + h->num_msgs, i);
+		for (j = 0; j < sd->num_ports; j++)
+			iaf_nl_put_port(&msg, sd->fabric_id, sd->sd_index,
+					sd->ports[j].port);
+		ret = iaf_nl_msg_finish(&msg);
+		if (ret < 0)
+			return ret;
+
+		len += ret;
+		h->msg_sd[h->num_msgs++] = i;
+	}
+	h->pending = h->num_msgs;
+	h->status_queries += h->num_msgs;
+
+	return len;
+}
+
+static inline struct iaf_health_port *
+__iaf_health_port(struct iaf_health_sd *sd, __u64 port)
+{
+	__u32 i;
+
+	for (i = 0; i < sd->num_ports; i++) {
+		if (sd->ports[i].port == port)
+			return &sd->ports[i];
+	}
+
+	return NULL;
+}
+
+/* Decode the status attributes of one port nest and apply them */
+static inline int
+__iaf_health_update(struct iaf_health *h, struct iaf_health_sd *sd,
+		    const struct iaf_nl_attr *port_attr, __u64 now)
+{
+	struct iaf_health_port *p;
+	struct iaf_nl_iter it;
+	struct iaf_nl_attr attr;
+	__u64 port = ~0ull, health = ~0ull, lqi = 0;
+	__u16 flags = 0;
+	__u8 old_health;
+	__u16 old_flags;
+
+	iaf_nl_attr_nested(port_attr, &it);
+	while (iaf_nl_iter_next(&it, &attr) > 0) {
+		__u64 v = iaf_nl_attr_uint(&attr);
+
+		switch (attr.type) {
+		case IAF_ATTR_FABRIC_PORT_NUMBER:
+			port = v;
+			break;
+		case IAF_ATTR_FPORT_HEALTH:
+			health = v;
+			break;
+		case IAF_ATTR_FPORT_LINK_QUALITY_INDICATOR:
+			lqi = v;
+			break;
+		case IAF_ATTR_FPORT_ISSUE_LQI:
+		case IAF_ATTR_FPORT_ISSUE_LWD:
+		case IAF_ATTR_FPORT_ISSUE_RATE:
+		case IAF_ATTR_FPORT_ERROR_FAILED:
+		case IAF_ATTR_FPORT_ERROR_ISOLATED:
+		case IAF_ATTR_FPORT_ERROR_FLAPPING:
+		case IAF_ATTR_FPORT_ERROR_LINK_DOWN:
+		case IAF_ATTR_FPORT_ERROR_DID_NOT_TRAIN:
+			/* The flags are consecutive attributes */
+			if (v)
+				flags |= 1 << (attr.type - IAF_ATTR_FPORT_ISSUE_LQI);
+			break;
+		}
+	}
+
+	/* Without a health state the nest says nothing to compare against */
+	if (health == ~0ull)
+		return -EBADMSG;
+
+	p = __iaf_health_port(sd, port);
+	if (!p)
+		return -ENOENT;
+
+	old_health = p->health;
+	old_flags = p->flags;
+	p->health = health;
+	p->flags = flags;
+	p->lqi = lqi;
+
+	if (!p->primed) {
+		p->primed = 1;
+		p->since = now;
+		return 0;
+	}
+
+	if (p->health != old_health || p->flags != old_flags) {
+		p->since = now;
+		p->transitions++;
+		if (h->transition)
+			h->transition(h->data, sd, p, old_health, old_flags);
+	}
+
+	return 0;
+}
+
+/**
+ * iaf_health_decode_status - Consume phase 2 replies
+ * @h: monitor
+ * @buf: received data, 4-byte aligned
+ * @len: number of bytes in @buf
+ * @now: caller's clock, used to stamp transitions
+ *
+ * A sub-device is clean again once a reply covering its ports has been
+ * applied; after a failed reply it stays dirty for the next poll.
+ *
+ * Return: the number of ports updated, or -EBADMSG.
+ */
+static inline int
+iaf_health_decode_status(struct iaf_health *h, const void *buf, __u32 len,
+			 __u64 now)
+{
+	const struct nlmsghdr *nlh;
+	__u32 off = 0;
+	int updated = 0;
+
+	while ((nlh = iaf_nl_msg_next(buf, len, &off))) {
+		struct iaf_health_sd *sd = __iaf_health_match(h, nlh);
+		struct iaf_nl_reply reply;
+		struct iaf_nl_iter it;
+		struct iaf_nl_attr attr;
+		int bad = 0;
+
+		if (!sd)
+			continue;
+
+		if (iaf_nl_reply_parse(nlh, &reply)) {
+			h->errors++;
+			continue;
+		}
+
+		iaf_nl_iter_init(&it, reply.attrs, reply.attrs_len);
+		while (iaf_nl_iter_next(&it, &attr) > 0) {
+			if (attr.type != IAF_ATTR_FABRIC_PORT)
+				continue;
+			if (__iaf_health_update(h, sd, &attr, now))
+				bad = 1;
+			else
+				updated++;
+		}
+
+		if (bad)
+			h->errors++;
+		else
+			sd->dirty = 0;
+	}
+
+	return off == len ? updated : -EBADMSG;
+}
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/socket.h>
+
+static inline int
+__iaf_health_exchange(struct iaf_health *h, int fd, void *buf, __u32 size,
+		      int len, int timeout_ms, int status, __u64 now)
+{
+	int ret, total = 0;
+	ssize_t n;
+
+	if (len <= 0)
+		return len;
+
+	do {
+		n = send(fd, buf, len, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return -errno;
+
+	while (h->pending) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+
+		ret = poll(&pfd, 1, timeout_ms);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+		if (!ret)
+			return -ETIME;
+
+		n = recv(fd, buf, size, MSG_DONTWAIT);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n < 0)
+			return -errno;
+
+		ret = status ? iaf_health_decode_status(h, buf, n, now) :
+			       iaf_health_decode_traps(h, buf, n);
+		if (ret < 0)
+			return ret;
+		total += ret;
+	}
+
+	return total;
+}
+
+/**
+ * iaf_health_poll - Run both phases on a netlink socket
+ * @h: monitor
+ * @fd: generic netlink socket, or any datagram socket speaking the protocol
+ * @buf: scratch buffer, 4-byte aligned
+ * @size: size of @buf
+ * @seq: first sequence number; the poll uses up to 2 * @num_sds of them
+ * @now: caller's clock, used to stamp transitions
+ * @timeout_ms: time to wait for each batch of replies
+ *
+ * Return: the number of ports updated, or a negative error code.
+ */
+static inline int
+iaf_health_poll(struct iaf_health *h, int fd, void *buf, __u32 size,
+		__u32 seq, __u64 now, int timeout_ms)
+{
+	int ret;
+
+	ret = __iaf_health_exchange(h, fd, buf, size,
+				    iaf_health_encode_traps(h, buf, size, seq),
+				    timeout_ms, 0, now);
+	if (ret < 0)
+		return ret;
+
+	return __iaf_health_exchange(h, fd, buf, size,
+				     iaf_health_encode_status(h, buf, size, seq + h->num_sds),
+				     timeout_ms, 1, now);
+}
+#endif
+
+#endif /* _IAF_HEALTH_H_ */
@@ -0,0 +1,632 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _IAF_NL_CODEC_H_
+#define _IAF_NL_CODEC_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/types.h>
+
+#include "iaf_netlink.h"
+
+/**
+ * DOC: IAF generic netlink codec
+ *
+ * The fabric driver exposes the &enum cmd_op operations on the
+ * %IAF_NL_FAMILY_NAME generic netlink family. A request is a struct nlmsghdr
+ * and a struct genlmsghdr with &genlmsghdr.version set to
+ * %INTERFACE_VERSION, followed by %IAF_ATTR_CMD_OP_MSG_TYPE =
+ * %IAF_CMD_MSG_REQUEST, an %IAF_ATTR_CMD_OP_CONTEXT echoed back in the reply
+ * and the attributes of the operation. The reply carries the
+ * &enum cmd_rsp result in %IAF_ATTR_CMD_OP_RESULT.
+ *
+ * struct iaf_nl_msg encodes a request straight into a caller-owned buffer.
+ * Running out of room is sticky, so a sequence of puts only needs to be
+ * checked once, in iaf_nl_msg_finish():
+ *
+ *   .. code:: c
+ *
+ *      __u8 buf[256];
+ *      struct iaf_nl_msg msg;
+ *
+ *      iaf_nl_msg_init(&msg, buf, sizeof(buf), family,
+ *                      IAF_CMD_OP_FPORT_STATUS_QUERY, seq, ctx);
+ *      iaf_nl_put_port(&msg, fabric_id, sd_index, port);
+ *      len = iaf_nl_msg_finish(&msg);
+ *
+ * Replies are decoded in place. iaf_nl_msg_next() steps over the netlink
+ * messages in a receive buffer, iaf_nl_reply_parse() validates one of them
+ * and struct iaf_nl_iter walks its attributes, descending into
+ * %IAF_ATTR_FABRIC_DEVICE, %IAF_ATTR_SUB_DEVICE and %IAF_ATTR_FABRIC_PORT
+ * nests without copying. Integer attributes are read whatever their width,
+ * and %IAF_ATTR_PAD attributes inserted before 64-bit values are skipped.
+ */
+
+#define IAF_NL_FAMILY_NAME	"iaf_ze"
+#define IAF_NL_MAX_NEST		4
+
+/* Returned by iaf_nl_reply_parse() for an NLMSG_ERROR acknowledgement */
+#define IAF_NL_ACK		1
+
+/**
+ * struct iaf_nl_msg - Request being encoded
+ */
+struct iaf_nl_msg {
+	__u8 *buf;
+	__u32 size;
+	__u32 len;
+
+	/** @err: First error, -EMSGSIZE if @buf was too small */
+	int err;
+
+	__u32 depth;
+	__u32 nest[IAF_NL_MAX_NEST];
+};
+
+static inline void *
+__iaf_nl_reserve(struct iaf_nl_msg *msg, __u32 len)
+{
+	void *p;
+
+	if (msg->err)
+		return NULL;
+	if (msg->size - msg->len < NLMSG_ALIGN(len)) {
+		msg->err = -EMSGSIZE;
+		return NULL;
+	}
+
+	p = msg->buf + msg->len;
+	memset(p, 0, NLMSG_ALIGN(len));
+	msg->len += NLMSG_ALIGN(len);
+
+	return p;
+}
+
+/**
+ * iaf_nl_put - Append an attribute
+ * @msg: message
+ * @type: &enum attr
+ * @data: payload
+ * @len: payload size, padded to 4 bytes in the message
+ */
+static inline void
+iaf_nl_put(struct iaf_nl_msg *msg, __u16 type, const void *data, __u16 len)
+{
+	struct nlattr *nla = (struct nlattr *)__iaf_nl_reserve(msg, NLA_HDRLEN + len);
+
+	if (!nla)
+		return;
+
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	memcpy((__u8 *)nla + NLA_HDRLEN, data, len);
+}
+
+static inline void
+iaf_nl_put_u8(struct iaf_nl_msg *msg, __u16 type, __u8 v)
+{
+	iaf_nl_put(msg, type, &v, sizeof(v));
+}
+
+static inline void
+iaf_nl_put_u16(struct iaf_nl_msg *msg, __u16 type, __u16 v)
+{
+	iaf_nl_put(msg, type, &v, sizeof(v));
+}
+
+static inline void
+iaf_nl_put_u32(struct iaf_nl_msg *msg, __u16 type, __u32 v)
+{
+	iaf_nl_put(msg, type, &v, sizeof(v));
+}
+
+static inline void
+iaf_nl_put_u64(struct iaf_nl_msg *msg, __u16 type, __u64 v)
+{
+	iaf_nl_put(msg, type, &v, sizeof(v));
+}
+
+static inline void
+iaf_nl_put_str(struct iaf_nl_msg *msg, __u16 type, const char *s)
+{
+	iaf_nl_put(msg, type, s, strlen(s) + 1);
+}
+
+/**
+ * iaf_nl_nest_start - Open a nested attribute
+ * @msg: message
+ * @type: %IAF_ATTR_FABRIC_DEVICE, %IAF_ATTR_SUB_DEVICE or
+ *	  %IAF_ATTR_FABRIC_PORT
+ *
+ * Close it with iaf_nl_nest_end(). At most %IAF_NL_MAX_NEST levels.
+ */
+static inline void
+iaf_nl_nest_start(struct iaf_nl_msg *msg, __u16 type)
+{
+	struct nlattr *nla;
+	__u32 off = msg->len;
+
+	if (!msg->err && msg->depth == IAF_NL_MAX_NEST)
+		msg->err = -E2BIG;
+
+	nla = (struct nlattr *)__iaf_nl_reserve(msg, NLA_HDRLEN);
+	if (!nla)
+		return;
+
+	nla->nla_type = NLA_F_NESTED | type;
+	msg->nest[msg->depth++] = off;
+}
+
+static inline void
+iaf_nl_nest_end(struct iaf_nl_msg *msg)
+{
+	struct nlattr *nla;
+
+	if (!msg->err && !msg->depth)
+		msg->err = -EINVAL;
+	if (msg->err)
+		return;
+
+	nla = (struct nlattr *)(msg->buf + msg->nest[--msg->depth]);
+	nla->nla_len = (__u8 *)msg->buf + msg->len - (__u8 *)nla;
+}
+
+/**
+ * iaf_nl_msg_init - Start a request
+ * @msg: message
+ * @buf: destination buffer, 4-byte aligned
+ * @size: size of @buf
+ * @family: family id, see iaf_nl_family_parse()
+ * @op: &enum cmd_op
+ * @seq: netlink sequence number, to match the reply
+ * @context: echoed back in %IAF_ATTR_CMD_OP_CONTEXT
+ */
+static inline void
+iaf_nl_msg_init(struct iaf_nl_msg *msg, void *buf, __u32 size, __u16 family,
+		enum cmd_op op, __u32 seq, __u64 context)
+{
+	struct nlmsghdr *nlh;
+	struct genlmsghdr *genl;
+
+	msg->buf = (__u8 *)buf;
+	msg->size = size;
+	msg->len = 0;
+	msg->err = 0;
+	msg->depth = 0;
+
+	nlh = (struct nlmsghdr *)__iaf_nl_reserve(msg, NLMSG_HDRLEN);
+	genl = (struct genlmsghdr *)__iaf_nl_reserve(msg, GENL_HDRLEN);
+	if (!genl)
+		return;
+
+	nlh->nlmsg_type = family;
+	nlh->nlmsg_flags = NLM_F_REQUEST;
+	nlh->nlmsg_seq = seq;
+	genl->cmd = op;
+	genl->version = INTERFACE_VERSION;
+
+	iaf_nl_put_u8(msg, IAF_ATTR_CMD_OP_MSG_TYPE, IAF_CMD_MSG_REQUEST);
+	iaf_nl_put_u64(msg, IAF_ATTR_CMD_OP_CONTEXT, context);
+}
+
+/**
+ * iaf_nl_reply_init - Start a reply, as the driver would send it
+ * @msg: message
+ * @buf: destination buffer, 4-byte aligned
+ * @size: size of @buf
+ * @family: family id
+ * @op: &enum cmd_op of the request
+ * @seq: sequence number of the request
+ * @context: %IAF_ATTR_CMD_OP_CONTEXT of the request
+ * @result: &enum cmd_rsp
+ *
+ * Meant for stand-in servers; the payload attributes follow.
+ */
+static inline void
+iaf_nl_reply_init(struct iaf_nl_msg *msg, void *buf, __u32 size, __u16 family,
+		  enum cmd_op op, __u32 seq, __u64 context, enum cmd_rsp result)
+{
+	struct nlmsghdr *nlh;
+	struct genlmsghdr *genl;
+
+	msg->buf = (__u8 *)buf;
+	msg->size = size;
+	msg->len = 0;
+	msg->err = 0;
+	msg->depth = 0;
+
+	nlh = (struct nlmsghdr *)__iaf_nl_reserve(msg, NLMSG_HDRLEN);
+	genl = (struct genlmsghdr *)__iaf_nl_reserve(msg, GENL_HDRLEN);
+	if (!genl)
+		return;
+
+	nlh->nlmsg_type = family;
+	nlh->nlmsg_seq = seq;
+	genl->cmd = op;
+	genl->version = INTERFACE_VERSION;
+
+	iaf_nl_put_u8(msg, IAF_ATTR_CMD_OP_MSG_TYPE, IAF_CMD_MSG_RESPONSE);
+	iaf_nl_put_u64(msg, IAF_ATTR_CMD_OP_CONTEXT, context);
+	iaf_nl_put_u8(msg, IAF_ATTR_CMD_OP_RESULT, result);
+}
+
+/**
+ * iaf_nl_put_sd - Address a sub-device
+ * @msg: message
+ * @fabric_id: %IAF_ATTR_FABRIC_ID
+ * @sd_index: %IAF_ATTR_SD_INDEX
+ */
+static inline void
+iaf_nl_put_sd(struct iaf_nl_msg *msg, __u32 fabric_id, __u8 sd_index)
+{
+	iaf_nl_put_u32(msg, IAF_ATTR_FABRIC_ID, fabric_id);
+	iaf_nl_put_u8(msg, IAF_ATTR_SD_INDEX, sd_index);
+}
+
+/**
+ * iaf_nl_put_port - Append one %IAF_ATTR_FABRIC_PORT to a port request
+ * @msg: message
+ * @fabric_id: %IAF_ATTR_FABRIC_ID
+ * @sd_index: %IAF_ATTR_SD_INDEX
+ * @port: %IAF_ATTR_FABRIC_PORT_NUMBER
+ *
+ * Port operations accept several of these in one request.
+ */
+static inline void
+iaf_nl_put_port(struct iaf_nl_msg *msg, __u32 fabric_id, __u8 sd_index,
+		__u8 port)
+{
+	iaf_nl_nest_start(msg, IAF_ATTR_FABRIC_PORT);
+	iaf_nl_put_sd(msg, fabric_id, sd_index);
+	iaf_nl_put_u8(msg, IAF_ATTR_FABRIC_PORT_NUMBER, port);
+	iaf_nl_nest_end(msg);
+}
+
+/**
+ * iaf_nl_msg_finish - Complete a request
+ * @msg: message
+ *
+ * Return: the length to send, or the first error hit while encoding.
+ */
+static inline int
+iaf_nl_msg_finish(struct iaf_nl_msg *msg)
+{
+	if (!msg->err && msg->depth)
+		msg->err = -EINVAL;
+	if (msg->err)
+		return msg->err;
+
+	((struct nlmsghdr *)msg->buf)->nlmsg_len = msg->len;
+	return msg->len;
+}
+
+/**
+ * struct iaf_nl_attr - Decoded attribute, pointing into the receive buffer
+ */
+struct iaf_nl_attr {
+	__u16 type;
+	__u16 len;
+	const void *data;
+};
+
+/**
+ * struct iaf_nl_iter - Cursor over a run of attributes
+ */
+struct iaf_nl_iter {
+	const __u8 *pos;
+	const __u8 *end;
+};
+
+static inline void
+iaf_nl_iter_init(struct iaf_nl_iter *it, const void *data, __u32 len)
+{
+	it->pos = (const __u8 *)data;
+	it->end = it->pos + len;
+}
+
+/**
+ * iaf_nl_iter_next - Step to the next attribute
+ * @it: cursor
+ * @attr: returns the attribute, with NLA_F_NESTED and NLA_F_NET_BYTEORDER
+ *	  stripped from the type
+ *
+ * Return: 1 if @attr was filled, 0 at the end or -EBADMSG if an attribute
+ * overruns its container.
+ */
+static inline int
+iaf_nl_iter_next(struct iaf_nl_iter *it, struct iaf_nl_attr *attr)
+{
+	struct nlattr nla;
+
+	for (;;) {
+		if (it->end - it->pos < NLA_HDRLEN)
+			return it->pos == it->end ? 0 : -EBADMSG;
+
+		memcpy(&nla, it->pos, sizeof(nla));
+		if (nla.nla_len < NLA_HDRLEN || nla.nla_len > it->end - it->pos)
+			return -EBADMSG;
+
+		attr->type = nla.nla_type & NLA_TYPE_MASK;
+		attr->len = nla.nla_len - NLA_HDRLEN;
+		attr->data = it->pos + NLA_HDRLEN;
+
+		if (it->end - it->pos < NLA_ALIGN(nla.nla_len))
+			it->pos = it->end;
+		else
+			it->pos += NLA_ALIGN(nla.nla_len);
+
+		if (attr->type != IAF_ATTR_PAD)
+			return 1;
+	}
+}
+
+/**
+ * iaf_nl_attr_nested - Open a cursor on the payload of a nested attribute
+ * @attr: attribute
+ * @it: cursor to initialise
+ */
+static inline void
+iaf_nl_attr_nested(const struct iaf_nl_attr *attr, struct iaf_nl_iter *it)
+{
+	iaf_nl_iter_init(it, attr->data, attr->len);
+}
+
+/**
+ * iaf_nl_attr_uint - Read an unsigned integer attribute of any width
+ * @attr: attribute with a 1, 2, 4 or 8 byte payload
+ *
+ * Return: the value, 0 for other payload sizes.
+ */
+static inline __u64
+iaf_nl_attr_uint(const struct iaf_nl_attr *attr)
+{
+	__u8 u8;
+	__u16 u16;
+	__u32 u32;
+	__u64 u64;
+
+	switch (attr->len) {
+	case 1: memcpy(&u8, attr->data, 1); return u8;
+	case 2: memcpy(&u16, attr->data, 2); return u16;
+	case 4: memcpy(&u32, attr->data, 4); return u32;
+	case 8: memcpy(&u64, attr->data, 8); return u64;
+	default: return 0;
+	}
+}
+
+/**
+ * iaf_nl_attr_str - Read a string attribute
+ * @attr: attribute
+ *
+ * Return: the NUL-terminated string in the receive buffer, or NULL if the
+ * payload is not terminated.
+ */
+static inline const char *
+iaf_nl_attr_str(const struct iaf_nl_attr *attr)
+{
+	const char *s = (const char *)attr->data;
+
+	return attr->len && memchr(s, '\0', attr->len) ? s : NULL;
+}
+
+/**
+ * iaf_nl_msg_next - Step to the next netlink message in a receive buffer
+ * @buf: data returned by recv()
+ * @len: number of bytes in @buf
+ * @offset: position in @buf, start at 0; advanced past the message
+ *
+ * Return: the message, or NULL when @buf is exhausted or the next header
+ * is truncated.
+ */
+static inline const struct nlmsghdr *
+iaf_nl_msg_next(const void *buf, __u32 len, __u32 *offset)
+{
+	const struct nlmsghdr *nlh =
+		(const struct nlmsghdr *)((const __u8 *)buf + *offset);
+	__u32 left = len - *offset;
+
+	if (*offset >= len || left < NLMSG_HDRLEN ||
+	    nlh->nlmsg_len < NLMSG_HDRLEN || nlh->nlmsg_len > left)
+		return NULL;
+
+	*offset += NLMSG_ALIGN(nlh->nlmsg_len) < left ?
+		   NLMSG_ALIGN(nlh->nlmsg_len) : left;
+	return nlh;
+}
+
+/**
+ * iaf_nl_rsp_errno - Map an &enum cmd_rsp to an errno
+ * @rsp: result from %IAF_ATTR_CMD_OP_RESULT
+ */
+static inline int
+iaf_nl_rsp_errno(__u64 rsp)
+{
+	switch (rsp) {
+	case IAF_CMD_RSP_SUCCESS:
+		return 0;
+	case IAF_CMD_RSP_NOMEM:
+		return -ENOMEM;
+	case IAF_CMD_RSP_MSGSIZE:
+		return -EMSGSIZE;
+	case IAF_CMD_RSP_AGAIN:
+		return -EAGAIN;
+	case IAF_CMD_RSP_INVALID_INTERFACE_VERSION:
+		return -EPROTO;
+	case IAF_CMD_RSP_UNKNOWN_FABRIC_ID:
+		return -ENODEV;
+	case IAF_CMD_RSP_SD_INDEX_OUT_OF_RANGE:
+	case IAF_CMD_RSP_PORT_RANGE_ERROR:
+		return -ERANGE;
+	case IAF_CMD_RSP_MISSING_FABRIC_ID:
+	case IAF_CMD_RSP_MISSING_SD_INDEX:
+	case IAF_CMD_RSP_MISSING_PORT_NUMBER:
+	case IAF_CMD_RSP_MISSING_MSG_TYPE:
+	case IAF_CMD_RSP_MSG_TYPE_NOT_REQUEST:
+		return -EINVAL;
+	default:
+		return -EIO;
+	}
+}
+
+/**
+ * struct iaf_nl_reply - Decoded reply header
+ */
+struct iaf_nl_reply {
+	__u32 seq;
+	__u8 op;
+	__u8 msg_type;
+
+	/** @result: &enum cmd_rsp */
+	__u8 result;
+
+	__u8 pad;
+	__u64 context;
+
+	/** @attrs: All attributes of the reply, for iaf_nl_iter_init() */
+	const void *attrs;
+	__u32 attrs_len;
+};
+
+/**
+ * iaf_nl_reply_parse - Validate one reply message
+ * @nlh: message from iaf_nl_msg_next()
+ * @reply: decoded header, filled even when the result is an error
+ *
+ * Return: 0 on success, %IAF_NL_ACK for an NLMSG_ERROR carrying no error
+ * (an acknowledgement, not a reply), the negative &nlmsgerr.error of any
+ * other NLMSG_ERROR, -EPROTO for a reply of another %INTERFACE_VERSION or
+ * without %IAF_CMD_MSG_RESPONSE, -EBADMSG for a malformed message, or the
+ * error of a failing &enum cmd_rsp as mapped by iaf_nl_rsp_errno().
+ */
+static inline int
+iaf_nl_reply_parse(const struct nlmsghdr *nlh, struct iaf_nl_reply *reply)
+{
+	const struct genlmsghdr *genl;
+	struct iaf_nl_iter it;
+	struct iaf_nl_attr attr;
+	int ret, have_type = 0, have_result = 0;
+
+	memset(reply, 0, sizeof(*reply));
+	reply->seq = nlh->nlmsg_seq;
+
+	if (nlh->nlmsg_type == NLMSG_ERROR) {
+		struct nlmsgerr err;
+
+		if (nlh->nlmsg_len < NLMSG_HDRLEN + sizeof(err.error))
+			return -EBADMSG;
+		memcpy(&err.error, NLMSG_DATA(nlh), sizeof(err.error));
+		return err.error ? err.error : IAF_NL_ACK;
+	}
+
+	if (nlh->nlmsg_len < NLMSG_HDRLEN + GENL_HDRLEN)
+		return -EBADMSG;
+
+	genl = (const struct genlmsghdr *)NLMSG_DATA(nlh);
+	reply->op = genl->cmd;
+	if (genl->version != INTERFACE_VERSION)
+		return -EPROTO;
+
+	reply->attrs = (const __u8 *)genl + GENL_HDRLEN;
+	reply->attrs_len = nlh->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN;
+
+	iaf_nl_iter_init(&it, reply->attrs, reply->attrs_len);
+	while ((ret = iaf_nl_iter_next(&it, &attr)) > 0) {
+		switch (attr.type) {
+		case IAF_ATTR_CMD_OP_MSG_TYPE:
+			reply->msg_type = iaf_nl_attr_uint(&attr);
+			have_type = 1;
+			break;
+		case IAF_ATTR_CMD_OP_RESULT:
+			reply->result = iaf_nl_attr_uint(&attr);
+			have_result = 1;
+			break;
+		case IAF_ATTR_CMD_OP_CONTEXT:
+			reply->context = iaf_nl_attr_uint(&attr);
+			break;
+		}
+	}
+	if (ret)
+		return ret;
+
+	if (!have_type || reply->msg_type != IAF_CMD_MSG_RESPONSE || !have_result)
+		return -EPROTO;
+
+	return iaf_nl_rsp_errno(reply->result);
+}
+
+/**
+ * iaf_nl_family_request - Encode a CTRL_CMD_GETFAMILY for the IAF family
+ * @msg: message
+ * @buf: destination buffer
+ * @size: size of @buf
+ * @seq: netlink sequence number
+ *
+ * Return: the length to send, or -EMSGSIZE.
+ */
+static inline int
+iaf_nl_family_request(struct iaf_nl_msg *msg, void *buf, __u32 size, __u32 seq)
+{
+	struct nlmsghdr *nlh;
+	struct genlmsghdr *genl;
+
+	msg->buf = (__u8 *)buf;
+	msg->size = size;
+	msg->len = 0;
+	msg->err = 0;
+	msg->depth = 0;
+
+	nlh = (struct nlmsghdr *)__iaf_nl_reserve(msg, NLMSG_HDRLEN);
+	genl = (struct genlmsghdr *)__iaf_nl_reserve(msg, GENL_HDRLEN);
+	if (genl) {
+		nlh->nlmsg_type = GENL_ID_CTRL;
+		nlh->nlmsg_flags = NLM_F_REQUEST;
+		nlh->nlmsg_seq = seq;
+		genl->cmd = CTRL_CMD_GETFAMILY;
+		genl->version = 1;
+	}
+	iaf_nl_put_str(msg, CTRL_ATTR_FAMILY_NAME, IAF_NL_FAMILY_NAME);
+
+	return iaf_nl_msg_finish(msg);
+}
+
+/**
+ * iaf_nl_family_parse - Extract the family id from a CTRL_CMD_NEWFAMILY
+ * @nlh: reply to iaf_nl_family_request()
+ *
+ * Return: the family id, -ENOENT if the driver is not loaded, or another
+ * negative error code.
+ */
+static inline int
+iaf_nl_family_parse(const struct nlmsghdr *nlh)
+{
+	struct iaf_nl_iter it;
+	struct iaf_nl_attr attr;
+	int ret;
+
+	if (nlh->nlmsg_type == NLMSG_ERROR) {
+		struct iaf_nl_reply reply;
+
+		ret = iaf_nl_reply_parse(nlh, &reply);
+		return ret < 0 ? ret : -EBADMSG;
+	}
+	if (nlh->nlmsg_type != GENL_ID_CTRL ||
+	    nlh->nlmsg_len < NLMSG_HDRLEN + GENL_HDRLEN)
+		return -EBADMSG;
+
+	iaf_nl_iter_init(&it, (const __u8 *)NLMSG_DATA(nlh) + GENL_HDRLEN,
+			 nlh->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN);
+	while ((ret = iaf_nl_iter_next(&it, &attr)) > 0) {
+		if (attr.type == CTRL_ATTR_FAMILY_ID)
+			return iaf_nl_attr_uint(&attr);
+	}
+
+	return ret ? ret : -ENOENT;
+}
+
+#endif /* _IAF_NL_CODEC_H_ */
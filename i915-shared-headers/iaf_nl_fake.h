@@ -0,0 +1,760 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _IAF_NL_FAKE_H_
+#define _IAF_NL_FAKE_H_
+
+#include <errno.h>
+#include <string.h>
+
+#include "iaf_nl_codec.h"
+
+/**
+ * DOC: IAF stand-in server
+ *
+ * struct iaf_fake answers every &enum cmd_op over a simulated fabric, so
+ * code built on iaf_netlink.h can run without Xe Link hardware.
+ * iaf_fake_handle() takes a buffer of requests and writes the replies the
+ * driver would send. It can be called in process, which serves requests
+ * as fast as the client can encode them, or through iaf_fake_serve_fd()
+ * on one end of a socketpair.
+ *
+ * The fabric is described by caller-owned arrays of struct iaf_fake_dev,
+ * struct iaf_fake_sd and struct iaf_fake_port. Connect two ports by
+ * setting their @peer_guid and @peer_port. The simulation is driven
+ * explicitly:
+ *
+ * - iaf_fake_advance() moves the device clock and integrates the port
+ *   byte counters at their @tx_rate and @rx_rate, or along &iaf_fake.curve,
+ *   wrapping at &iaf_fake.counter_bits.
+ * - iaf_fake_flap() takes a link down and brings it back, updating
+ *   health, flags, link down counts and trap counters on both ends.
+ * - iaf_fake_inject() makes the next requests of an operation fail with a
+ *   given &enum cmd_rsp.
+ *
+ * Requests are validated like the driver does: interface version,
+ * message type, fabric id, sub-device index and port number. Messages too
+ * short for a generic netlink header and unknown operations are rejected
+ * with an NLMSG_ERROR, as the generic netlink core does.
+ */
+
+/**
+ * struct iaf_fake_port - Simulated fabric port
+ */
+struct iaf_fake_port {
+	__u8 port;
+
+	/** @type: &enum iaf_fport_type */
+	__u8 type;
+
+	__u8 enabled;
+	__u8 usage;
+	__u8 beacon;
+	__u8 routed;
+
+	/** @health: &enum iaf_fport_health */
+	__u8 health;
+
+	/**
+	 * @flags: Bit N set reports attribute IAF_ATTR_FPORT_ISSUE_LQI + N as
+	 * set, for the ISSUE_LQI to ERROR_DID_NOT_TRAIN attributes
+	 */
+	__u8 flags;
+
+	__u8 lqi;
+
+	/** @width: %IAF_ATTR_FPORT_LINK_WIDTH_ACTIVE */
+	__u8 width;
+
+	__u8 peer_port;
+	__u8 pad;
+	__u32 link_down_count;
+
+	__u64 peer_guid;
+
+	/** @bps: %IAF_ATTR_FPORT_BPS_LINK_SPEED_ACTIVE */
+	__u64 bps;
+
+	__u64 tx_bytes;
+	__u64 rx_bytes;
+
+	/** @tx_rate: Bytes per second when &iaf_fake.curve is not set */
+	__u64 tx_rate;
+	__u64 rx_rate;
+
+	/** @tx_frac: Byte fraction carried to the next step, in 1/10^9 bytes */
+	__u32 tx_frac;
+	__u32 rx_frac;
+};
+
+/**
+ * struct iaf_fake_sd - Simulated sub-device
+ */
+struct iaf_fake_sd {
+	__u64 guid;
+
+	/** @traps: IAF_ATTR_SUB_DEVICE_PORT_*_TRAP_COUNT, in attribute order */
+	__u64 traps[5];
+
+	struct iaf_fake_port *ports;
+	__u32 num_ports;
+	__u32 pad;
+};
+
+/**
+ * struct iaf_fake_dev - Simulated fabric device
+ */
+struct iaf_fake_dev {
+	__u32 fabric_id;
+	__u8 socket_id;
+	__u8 pci_slot;
+	__u8 version;
+	__u8 product_type;
+
+	const char *name;
+	const char *parent_name;
+
+	struct iaf_fake_sd *sds;
+	__u32 num_sds;
+	__u32 pad;
+};
+
+/**
+ * typedef iaf_fake_curve_fn - Throughput curve
+ * @data: &iaf_fake.curve_data
+ * @port: port
+ * @now: device time in ns
+ * @rx: non-zero for the receive direction
+ *
+ * Return: the rate in bytes per second at @now.
+ */
+typedef __u64 (*iaf_fake_curve_fn)(void *data, const struct iaf_fake_port *port,
+				   __u64 now, int rx);
+
+/**
+ * struct iaf_fake - Stand-in server state
+ */
+struct iaf_fake {
+	struct iaf_fake_dev *devs;
+	__u32 num_devs;
+	__u16 family;
+	__u16 pad;
+
+	/** @counter_bits: Width of the byte counters */
+	__u32 counter_bits;
+
+	__u32 gen_start;
+	__u32 gen_end;
+	__u32 pad2;
+
+	/** @now: Device time in ns */
+	__u64 now;
+
+	iaf_fake_curve_fn curve;
+	void *curve_data;
+
+	/** @requests: Requests handled, per operation */
+	__u64 requests[_IAF_CMD_OP_COUNT];
+
+	__u8 inject[_IAF_CMD_OP_COUNT];
+	__u32 inject_count[_IAF_CMD_OP_COUNT];
+};
+
+static inline void
+iaf_fake_init(struct iaf_fake *f, struct iaf_fake_dev *devs, __u32 num_devs,
+	      __u16 family)
+{
+	memset(f, 0, sizeof(*f));
+	f->devs = devs;
+	f->num_devs = num_devs;
+	f->family = family;
+	f->counter_bits = 64;
+}
+
+/**
+ * iaf_fake_inject - Fail the next requests of an operation
+ * @f: server
+ * @op: &enum cmd_op
+ * @rsp: result to return
+ * @count: number of requests to fail, ~0 for all of them
+ */
+static inline void
+iaf_fake_inject(struct iaf_fake *f, enum cmd_op op, enum cmd_rsp rsp,
+		__u32 count)
+{
+	f->inject[op] = rsp;
+	f->inject_count[op] = count;
+}
+
+static inline __u64
+__iaf_fake_mask(const struct iaf_fake *f)
+{
+	return f->counter_bits < 64 ? (1ull << f->counter_bits) - 1 : ~0ull;
+}
+
+static inline struct iaf_fake_port *
+__iaf_fake_find_guid(struct iaf_fake *f, __u64 guid, __u8 port,
+		     struct iaf_fake_sd **sdp)
+{
+	__u32 d, s, p;
+
+	for (d = 0; d < f->num_devs; d++) {
+		for (s = 0; s < f->devs[d].num_sds; s++) {
+			struct iaf_fake_sd *sd = &f->devs[d].sds[s];
+
+			if (sd->guid != guid)
+				continue;
+			for (p = 0; p < sd->num_ports; p++) {
+				if (sd->ports[p].port == port) {
+					*sdp = sd;
+					return &sd->ports[p];
+				}
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Bytes counted at @rate over @ns, carrying the fraction in @frac. Splitting
+ * @ns into seconds and @rate into 10^9 multiples keeps the product that is
+ * divided below 10^18; the other terms may wrap, as the counters do anyway.
+ */
+static inline __u64
+__iaf_fake_bytes(__u64 rate, __u64 ns, __u32 *frac)
+{
+	__u64 sec = ns / 1000000000u, rem = ns % 1000000000u;
+	__u64 part = (rate % 1000000000u) * rem + *frac;
+
+	*frac = part % 1000000000u;
+
+	return rate * sec + rate / 1000000000u * rem + part / 1000000000u;
+}
+
+/**
+ * iaf_fake_advance - Move the device clock
+ * @f: server
+ * @ns: time step
+ *
+ * Enabled, healthy or degraded ports count bytes at their current rate.
+ */
+static inline void
+iaf_fake_advance(struct iaf_fake *f, __u64 ns)
+{
+	__u64 mask = __iaf_fake_mask(f);
+	__u32 d, s, p;
+
+	f->now += ns;
+
+	for (d = 0; d < f->num_devs; d++) {
+		for (s = 0; s < f->devs[d].num_sds; s++) {
+			struct iaf_fake_sd *sd = &f->devs[d].sds[s];
+
+			for (p = 0; p < sd->num_ports; p++) {
+				struct iaf_fake_port *port = &sd->ports[p];
+				__u64 tx = port->tx_rate, rx = port->rx_rate;
+
+				if (!port->enabled || port->health < IAF_FPORT_HEALTH_DEGRADED)
+					continue;
+
+				if (f->curve) {
+					tx = f->curve(f->curve_data, port, f->now, 0);
+					rx = f->curve(f->curve_data, port, f->now, 1);
+				}
+				port->tx_bytes = (port->tx_bytes +
+						  __iaf_fake_bytes(tx, ns, &port->tx_frac)) & mask;
+				port->rx_bytes = (port->rx_bytes +
+						  __iaf_fake_bytes(rx, ns, &port->rx_frac)) & mask;
+			}
+		}
+	}
+}
+
+static inline void
+__iaf_fake_link_event(struct iaf_fake_sd *sd, struct iaf_fake_port *port,
+		      int up)
+{
+	if (up) {
+		port->health = IAF_FPORT_HEALTH_HEALTHY;
+		port->flags &= ~(1 << (IAF_ATTR_FPORT_ERROR_LINK_DOWN - IAF_ATTR_FPORT_ISSUE_LQI));
+	} else {
+		port->health = IAF_FPORT_HEALTH_FAILED;
+		port->flags |= 1 << (IAF_ATTR_FPORT_ERROR_LINK_DOWN - IAF_ATTR_FPORT_ISSUE_LQI);
+		port->link_down_count++;
+	}
+
+	/* IAF_ATTR_SUB_DEVICE_PORT_STATE_CHANGE_TRAP_COUNT */
+	sd->traps[0]++;
+}
+
+/**
+ * iaf_fake_flap - Change the link state of a port and its peer
+ * @f: server
+ * @guid: sub-device of the port
+ * @port: port number
+ * @up: 0 to take the link down, 1 to bring it up
+ *
+ * Return: 0 on success or -ENOENT.
+ */
+static inline int
+iaf_fake_flap(struct iaf_fake *f, __u64 guid, __u8 port, int up)
+{
+	struct iaf_fake_sd *sd, *peer_sd;
+	struct iaf_fake_port *p, *peer;
+
+	p = __iaf_fake_find_guid(f, guid, port, &sd);
+	if (!p)
+		return -ENOENT;
+
+	__iaf_fake_link_event(sd, p, up);
+
+	peer = __iaf_fake_find_guid(f, p->peer_guid, p->peer_port, &peer_sd);
+	if (peer)
+		__iaf_fake_link_event(peer_sd, peer, up);
+
+	return 0;
+}
+
+/* Request attributes relevant to addressing */
+struct __iaf_fake_addr {
+	__u64 fabric_id;
+	__u64 sd_index;
+	__u64 port;
+	unsigned int have;
+};
+
+static inline void
+__iaf_fake_addr_attr(struct __iaf_fake_addr *a, const struct iaf_nl_attr *attr)
+{
+	switch (attr->type) {
+	case IAF_ATTR_FABRIC_ID:
+		a->fabric_id = iaf_nl_attr_uint(attr);
+		a->have |= 1;
+		break;
+	case IAF_ATTR_SD_INDEX:
+		a->sd_index = iaf_nl_attr_uint(attr);
+		a->have |= 2;
+		break;
+	case IAF_ATTR_FABRIC_PORT_NUMBER:
+		a->port = iaf_nl_attr_uint(attr);
+		a->have |= 4;
+		break;
+	}
+}
+
+/* Resolve an address, returns an enum cmd_rsp */
+static inline enum cmd_rsp
+__iaf_fake_resolve(struct iaf_fake *f, const struct __iaf_fake_addr *a,
+		   unsigned int need, struct iaf_fake_dev **devp,
+		   struct iaf_fake_sd **sdp, struct iaf_fake_port **portp)
+{
+	struct iaf_fake_dev *dev = NULL;
+	__u32 i;
+
+	if (!(a->have & 1))
+		return IAF_CMD_RSP_MISSING_FABRIC_ID;
+	for (i = 0; i < f->num_devs; i++) {
+		if (f->devs[i].fabric_id == a->fabric_id)
+			dev = &f->devs[i];
+	}
+	if (!dev)
+		return IAF_CMD_RSP_UNKNOWN_FABRIC_ID;
+	*devp = dev;
+	if (!(need & 2))
+		return IAF_CMD_RSP_SUCCESS;
+
+	if (!(a->have & 2))
+		return IAF_CMD_RSP_MISSING_SD_INDEX;
+	if (a->sd_index >= dev->num_sds)
+		return IAF_CMD_RSP_SD_INDEX_OUT_OF_RANGE;
+	*sdp = &dev->sds[a->sd_index];
+	if (!(need & 4))
+		return IAF_CMD_RSP_SUCCESS;
+
+	if (!(a->have & 4))
+		return IAF_CMD_RSP_MISSING_PORT_NUMBER;
+	for (i = 0; i < (*sdp)->num_ports; i++) {
+		if ((*sdp)->ports[i].port == a->port) {
+			*portp = &(*sdp)->ports[i];
+			return IAF_CMD_RSP_SUCCESS;
+		}
+	}
+
+	return IAF_CMD_RSP_PORT_RANGE_ERROR;
+}
+
+static inline int
+__iaf_fake_port_op(enum cmd_op op)
+{
+	switch (op) {
+	case IAF_CMD_OP_PORT_ENABLE:
+	case IAF_CMD_OP_PORT_DISABLE:
+	case IAF_CMD_OP_PORT_STATE_QUERY:
+	case IAF_CMD_OP_PORT_USAGE_ENABLE:
+	case IAF_CMD_OP_PORT_USAGE_DISABLE:
+	case IAF_CMD_OP_PORT_USAGE_STATE_QUERY:
+	case IAF_CMD_OP_PORT_BEACON_ENABLE:
+	case IAF_CMD_OP_PORT_BEACON_DISABLE:
+	case IAF_CMD_OP_PORT_BEACON_STATE_QUERY:
+	case IAF_CMD_OP_PORT_ROUTED_QUERY:
+	case IAF_CMD_OP_FPORT_STATUS_QUERY:
+	case IAF_CMD_OP_FPORT_PROPERTIES:
+	case IAF_CMD_OP_FPORT_THROUGHPUT:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Apply a port operation and append its per-port reply attributes */
+static inline void
+__iaf_fake_port_reply(struct iaf_fake *f, struct iaf_nl_msg *msg,
+		      enum cmd_op op, const struct __iaf_fake_addr *a,
+		      struct iaf_fake_port *p)
+{
+	__u32 i;
+
+	switch (op) {
+	case IAF_CMD_OP_PORT_ENABLE:
+	case IAF_CMD_OP_PORT_DISABLE:
+		p->enabled = op == IAF_CMD_OP_PORT_ENABLE;
+		return;
+	case IAF_CMD_OP_PORT_USAGE_ENABLE:
+	case IAF_CMD_OP_PORT_USAGE_DISABLE:
+		p->usage = op == IAF_CMD_OP_PORT_USAGE_ENABLE;
+		return;
+	case IAF_CMD_OP_PORT_BEACON_ENABLE:
+	case IAF_CMD_OP_PORT_BEACON_DISABLE:
+		p->beacon = op == IAF_CMD_OP_PORT_BEACON_ENABLE;
+		return;
+	default:
+		break;
+	}
+
+	iaf_nl_nest_start(msg, op == IAF_CMD_OP_FPORT_THROUGHPUT ?
+				IAF_ATTR_FABRIC_PORT_THROUGHPUT :
+				IAF_ATTR_FABRIC_PORT);
+	iaf_nl_put_u32(msg, IAF_ATTR_FABRIC_ID, a->fabric_id);
+	iaf_nl_put_u8(msg, IAF_ATTR_SD_INDEX, a->sd_index);
+	iaf_nl_put_u8(msg, IAF_ATTR_FABRIC_PORT_NUMBER, p->port);
+
+	switch (op) {
+	case IAF_CMD_OP_PORT_STATE_QUERY:
+		iaf_nl_put_u8(msg, IAF_ATTR_ENABLED_STATE, p->enabled);
+		break;
+	case IAF_CMD_OP_PORT_USAGE_STATE_QUERY:
+		iaf_nl_put_u8(msg, IAF_ATTR_ENABLED_STATE, p->usage);
+		break;
+	case IAF_CMD_OP_PORT_BEACON_STATE_QUERY:
+		iaf_nl_put_u8(msg, IAF_ATTR_ENABLED_STATE, p->beacon);
+		break;
+	case IAF_CMD_OP_PORT_ROUTED_QUERY:
+		iaf_nl_put_u8(msg, IAF_ATTR_FPORT_ROUTED, p->routed);
+		break;
+	case IAF_CMD_OP_FPORT_STATUS_QUERY:
+		iaf_nl_put_u8(msg, IAF_ATTR_FPORT_HEALTH, p->health);
+		for (i = IAF_ATTR_FPORT_ISSUE_LQI; i <= IAF_ATTR_FPORT_ERROR_DID_NOT_TRAIN; i++)
+			iaf_nl_put_u8(msg, i, p->flags >> (i - IAF_ATTR_FPORT_ISSUE_LQI) & 1);
+		break;
+	case IAF_CMD_OP_FPORT_PROPERTIES:
+		iaf_nl_put_u8(msg, IAF_ATTR_FABRIC_PORT_TYPE, p->type);
+		iaf_nl_put_u32(msg, IAF_ATTR_FPORT_LINK_DOWN_COUNT, p->link_down_count);
+		iaf_nl_put_u64(msg, IAF_ATTR_FPORT_NEIGHBOR_GUID, p->peer_guid);
+		iaf_nl_put_u8(msg, IAF_ATTR_FPORT_NEIGHBOR_PORT_NUMBER, p->peer_port);
+		iaf_nl_put_u8(msg, IAF_ATTR_FPORT_LINK_WIDTH_ACTIVE, p->width);
+		iaf_nl_put_u64(msg, IAF_ATTR_FPORT_BPS_LINK_SPEED_ACTIVE, p->bps);
+		iaf_nl_put_u8(msg, IAF_ATTR_FPORT_LINK_QUALITY_INDICATOR, p->lqi);
+		break;
+	case IAF_CMD_OP_FPORT_THROUGHPUT:
+		iaf_nl_put_u64(msg, IAF_ATTR_TIMESTAMP, f->now);
+		iaf_nl_put_u64(msg, IAF_ATTR_FPORT_TX_BYTES, p->tx_bytes);
+		iaf_nl_put_u64(msg, IAF_ATTR_FPORT_RX_BYTES, p->rx_bytes);
+		break;
+	default:
+		break;
+	}
+
+	iaf_nl_nest_end(msg);
+}
+
+static inline void
+__iaf_fake_dev_attrs(struct iaf_nl_msg *msg, const struct iaf_fake_dev *dev)
+{
+	iaf_nl_put_u32(msg, IAF_ATTR_FABRIC_ID, dev->fabric_id);
+	if (dev->name)
+		iaf_nl_put_str(msg, IAF_ATTR_DEV_NAME, dev->name);
+	if (dev->parent_name)
+		iaf_nl_put_str(msg, IAF_ATTR_PARENT_DEV_NAME, dev->parent_name);
+	iaf_nl_put_u8(msg, IAF_ATTR_SOCKET_ID, dev->socket_id);
+	iaf_nl_put_u8(msg, IAF_ATTR_PCI_SLOT_NUM, dev->pci_slot);
+	iaf_nl_put_u8(msg, IAF_ATTR_SUBDEVICE_COUNT, dev->num_sds);
+	iaf_nl_put_u8(msg, IAF_ATTR_VERSION, dev->version);
+	iaf_nl_put_u8(msg, IAF_ATTR_PRODUCT_TYPE, dev->product_type);
+}
+
+/* Reject a request the way netlink_rcv_skb() does, returns the reply length */
+static inline int
+__iaf_fake_nlerr(const struct nlmsghdr *nlh, void *out, __u32 size, int error)
+{
+	struct nlmsghdr *reply = (struct nlmsghdr *)out;
+	struct nlmsgerr *err = (struct nlmsgerr *)NLMSG_DATA(reply);
+
+	if (size < NLMSG_LENGTH(sizeof(*err)))
+		return -EMSGSIZE;
+
+	memset(out, 0, NLMSG_LENGTH(sizeof(*err)));
+	reply->nlmsg_len = NLMSG_LENGTH(sizeof(*err));
+	reply->nlmsg_type = NLMSG_ERROR;
+	reply->nlmsg_flags = NLM_F_CAPPED;
+	reply->nlmsg_seq = nlh->nlmsg_seq;
+	err->error = error;
+	err->msg = *nlh;
+
+	return reply->nlmsg_len;
+}
+
+/* Validate one request and encode its reply, returns the reply length */
+static inline int
+__iaf_fake_one(struct iaf_fake *f, const struct nlmsghdr *nlh, void *out,
+	       __u32 size)
+{
+	const struct genlmsghdr *genl = (const struct genlmsghdr *)NLMSG_DATA(nlh);
+	struct __iaf_fake_addr top = { 0, 0, 0, 0 };
+	struct iaf_fake_dev *dev = NULL;
+	struct iaf_fake_sd *sd = NULL;
+	struct iaf_fake_port *port = NULL;
+	enum cmd_rsp rsp = IAF_CMD_RSP_SUCCESS;
+	struct iaf_nl_iter it;
+	struct iaf_nl_attr attr;
+	struct iaf_nl_msg msg;
+	__u64 context = 0, msg_type = ~0ull;
+	enum cmd_op op;
+	__u32 i;
+	int ret;
+
+	if (nlh->nlmsg_len < NLMSG_HDRLEN + GENL_HDRLEN)
+		return __iaf_fake_nlerr(nlh, out, size, -EINVAL);
+
+	op = (enum cmd_op)genl->cmd;
+	if (op <= IAF_CMD_OP_UNSPEC || op >= _IAF_CMD_OP_COUNT)
+		return __iaf_fake_nlerr(nlh, out, size, -EOPNOTSUPP);
+	f->requests[op]++;
+
+	iaf_nl_iter_init(&it, (const __u8 *)genl + GENL_HDRLEN,
+			 nlh->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN);
+	while ((ret = iaf_nl_iter_next(&it, &attr)) > 0) {
+		if (attr.type == IAF_ATTR_CMD_OP_MSG_TYPE)
+			msg_type = iaf_nl_attr_uint(&attr);
+		else if (attr.type == IAF_ATTR_CMD_OP_CONTEXT)
+			context = iaf_nl_attr_uint(&attr);
+		else
+			__iaf_fake_addr_attr(&top, &attr);
+	}
+
+	/* Validate first so a failing request has no side effect */
+	if (ret)
+		rsp = IAF_CMD_RSP_FAILURE;
+	else if (genl->version != INTERFACE_VERSION)
+		rsp = IAF_CMD_RSP_INVALID_INTERFACE_VERSION;
+	else if (msg_type == ~0ull)
+		rsp = IAF_CMD_RSP_MISSING_MSG_TYPE;
+	else if (msg_type != IAF_CMD_MSG_REQUEST)
+		rsp = IAF_CMD_RSP_MSG_TYPE_NOT_REQUEST;
+	else if (f->inject_count[op]) {
+		rsp = (enum cmd_rsp)f->inject[op];
+		if (f->inject_count[op] != ~0u)
+			f->inject_count[op]--;
+	}
+
+	if (rsp == IAF_CMD_RSP_SUCCESS) {
+		switch (op) {
+		case IAF_CMD_OP_FABRIC_DEVICE_PROPERTIES:
+			rsp = __iaf_fake_resolve(f, &top, 1, &dev, &sd, &port);
+			break;
+		case IAF_CMD_OP_SUB_DEVICE_PROPERTIES_GET:
+		case IAF_CMD_OP_SUB_DEVICE_TRAP_COUNT_QUERY:
+			rsp = __iaf_fake_resolve(f, &top, 3, &dev, &sd, &port);
+			break;
+		case IAF_CMD_OP_FPORT_XMIT_RECV_COUNTS:
+			rsp = __iaf_fake_resolve(f, &top, 7, &dev, &sd, &port);
+			break;
+		default:
+			if (!__iaf_fake_port_op(op))
+				break;
+			iaf_nl_iter_init(&it, (const __u8 *)genl + GENL_HDRLEN,
+					 nlh->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN);
+			while (rsp == IAF_CMD_RSP_SUCCESS &&
+			       iaf_nl_iter_next(&it, &attr) > 0) {
+				struct __iaf_fake_addr a = { 0, 0, 0, 0 };
+				struct iaf_nl_iter in;
+
+				if (attr.type != IAF_ATTR_FABRIC_PORT)
+					continue;
+				iaf_nl_attr_nested(&attr, &in);
+				while (iaf_nl_iter_next(&in, &attr) > 0)
+					__iaf_fake_addr_attr(&a, &attr);
+				rsp = __iaf_fake_resolve(f, &a, 7, &dev, &sd, &port);
+			}
+			break;
+		}
+	}
+
+	iaf_nl_reply_init(&msg, out, size, f->family, op, nlh->nlmsg_seq,
+			  context, rsp);
+	if (rsp != IAF_CMD_RSP_SUCCESS)
+		return iaf_nl_msg_finish(&msg);
+
+	switch (op) {
+	case IAF_CMD_OP_DEVICE_ENUM:
+		iaf_nl_put_u16(&msg, IAF_ATTR_ENTRIES, f->num_devs);
+		for (i = 0; i < f->num_devs; i++) {
+			__u32 s;
+
+			iaf_nl_nest_start(&msg, IAF_ATTR_FABRIC_DEVICE);
+			__iaf_fake_dev_attrs(&msg, &f->devs[i]);
+			for (s = 0; s < f->devs[i].num_sds; s++) {
+				iaf_nl_nest_start(&msg, IAF_ATTR_SUB_DEVICE);
+				iaf_nl_put_u8(&msg, IAF_ATTR_SD_INDEX, s);
+				iaf_nl_put_u64(&msg, IAF_ATTR_GUID, f->devs[i].sds[s].guid);
+				iaf_nl_nest_end(&msg);
+			}
+			iaf_nl_nest_end(&msg);
+		}
+		break;
+	case IAF_CMD_OP_REM_REQUEST:
+		/* Routing completes at once */
+		f->gen_start = ++f->gen_end;
+		break;
+	case IAF_CMD_OP_ROUTING_GEN_QUERY:
+		iaf_nl_put_u32(&msg, IAF_ATTR_ROUTING_GEN_START, f->gen_start);
+		iaf_nl_put_u32(&msg, IAF_ATTR_ROUTING_GEN_END, f->gen_end);
+		break;
+	case IAF_CMD_OP_FABRIC_DEVICE_PROPERTIES:
+		__iaf_fake_dev_attrs(&msg, dev);
+		break;
+	case IAF_CMD_OP_SUB_DEVICE_PROPERTIES_GET:
+		iaf_nl_put_u64(&msg, IAF_ATTR_GUID, sd->guid);
+		iaf_nl_put_u8(&msg, IAF_ATTR_EXTENDED_PORT_COUNT, sd->num_ports);
+		iaf_nl_put_u8(&msg, IAF_ATTR_FABRIC_PORT_COUNT, sd->num_ports);
+		for (i = 0; i < sd->num_ports; i++) {
+			iaf_nl_nest_start(&msg, IAF_ATTR_FABRIC_PORT);
+			iaf_nl_put_u8(&msg, IAF_ATTR_FABRIC_PORT_NUMBER, sd->ports[i].port);
+			iaf_nl_put_u8(&msg, IAF_ATTR_FABRIC_PORT_TYPE, sd->ports[i].type);
+			iaf_nl_nest_end(&msg);
+		}
+		break;
+	case IAF_CMD_OP_SUB_DEVICE_TRAP_COUNT_QUERY:
+		iaf_nl_put_u64(&msg, IAF_ATTR_SUB_DEVICE_TRAP_COUNT,
+			       sd->traps[0] + sd->traps[1] + sd->traps[2] +
+			       sd->traps[3] + sd->traps[4]);
+		for (i = 0; i < 5; i++)
+			iaf_nl_put_u64(&msg, IAF_ATTR_SUB_DEVICE_PORT_STATE_CHANGE_TRAP_COUNT + i,
+				       sd->traps[i]);
+		break;
+	case IAF_CMD_OP_FPORT_XMIT_RECV_COUNTS:
+		iaf_nl_put_u64(&msg, IAF_ATTR_TIMESTAMP, f->now);
+		iaf_nl_put_u64(&msg, IAF_ATTR_FPORT_TX_BYTES, port->tx_bytes);
+		iaf_nl_put_u64(&msg, IAF_ATTR_FPORT_RX_BYTES, port->rx_bytes);
+		break;
+	default:
+		iaf_nl_iter_init(&it, (const __u8 *)genl + GENL_HDRLEN,
+				 nlh->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN);
+		while (iaf_nl_iter_next(&it, &attr) > 0) {
+			struct __iaf_fake_addr a = { 0, 0, 0, 0 };
+			struct iaf_nl_iter in;
+
+			if (attr.type != IAF_ATTR_FABRIC_PORT)
+				continue;
+			iaf_nl_attr_nested(&attr, &in);
+			while (iaf_nl_iter_next(&in, &attr) > 0)
+				__iaf_fake_addr_attr(&a, &attr);
+			__iaf_fake_resolve(f, &a, 7, &dev, &sd, &port);
+			__iaf_fake_port_reply(f, &msg, op, &a, port);
+		}
+		break;
+	}
+
+	ret = iaf_nl_msg_finish(&msg);
+	if (ret == -EMSGSIZE) {
+		iaf_nl_reply_init(&msg, out, size, f->family, op,
+				  nlh->nlmsg_seq, context, IAF_CMD_RSP_MSGSIZE);
+		ret = iaf_nl_msg_finish(&msg);
+	}
+
+	return ret;
+}
+
+/**
+ * iaf_fake_handle - Answer a buffer of requests
+ * @f: server
+ * @req: requests, 4-byte aligned
+ * @len: length of @req
+ * @out: replies, 4-byte aligned
+ * @size: size of @out
+ *
+ * Every request gets one reply: an IAF reply, or an NLMSG_ERROR for
+ * messages too short to carry a command and for unknown operations.
+ *
+ * Return: the length of the replies, or -EMSGSIZE if @out cannot hold even
+ * an error reply.
+ */
+static inline int
+iaf_fake_handle(struct iaf_fake *f, const void *req, __u32 len, void *out,
+		__u32 size)
+{
+	const struct nlmsghdr *nlh;
+	__u32 off = 0, olen = 0;
+	int ret;
+
+	while ((nlh = iaf_nl_msg_next(req, len, &off))) {
+		ret = __iaf_fake_one(f, nlh, (__u8 *)out + olen, size - olen);
+		if (ret < 0)
+			return ret;
+		olen += ret;
+	}
+
+	return olen;
+}
+
+#ifdef __linux__
+#include <sys/socket.h>
+
+/**
+ * iaf_fake_serve_fd - Answer one datagram of requests on a socket
+ * @f: server
+ * @fd: server end of a SOCK_SEQPACKET or SOCK_DGRAM socketpair
+ * @buf: scratch buffer for requests, 4-byte aligned
+ * @out: scratch buffer for replies, 4-byte aligned
+ * @size: size of @buf and of @out
+ *
+ * Return: the number of bytes sent, 0 when the peer closed the socket, or
+ * a negative error code.
+ */
+static inline int
+iaf_fake_serve_fd(struct iaf_fake *f, int fd, void *buf, void *out, __u32 size)
+{
+	ssize_t n;
+	int len;
+
+	do {
+		n = recv(fd, buf, size, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0)
+		return n < 0 ? -errno : 0;
+
+	len = iaf_fake_handle(f, buf, n, out, size);
+	if (len <= 0)
+		return len;
+
+	do {
+		n = send(fd, out, len, 0);
+	} while (n < 0 && errno == EINTR);
+
+	return n < 0 ? -errno : (int)n;
+}
+#endif
+
+#endif /* _IAF_NL_FAKE_H_ */
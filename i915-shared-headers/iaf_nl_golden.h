@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _IAF_NL_GOLDEN_H_
+#define _IAF_NL_GOLDEN_H_
+
+#include "iaf_nl_codec.h"
+
+/**
+ * DOC: IAF netlink golden messages
+ *
+ * Byte-exact messages of the IAF generic netlink interface, written out by
+ * hand from the netlink and genetlink wire format in host (little endian)
+ * byte order, with family id 0x20. iaf_nl_golden_check() runs the codec
+ * against them, so a test suite or a self test at start-up can catch an
+ * encoder or decoder that drifted from the format.
+ */
+
+/*
+ * PORT_STATE_QUERY request, seq 7, context 0x1122334455667788, for port 5
+ * of sub-device 1 of fabric 0xabc.
+ */
+static const __u8 iaf_nl_golden_port_state_req[] __attribute__((aligned(4))) = {
+	68, 0, 0, 0,  0x20, 0,  1, 0,  7, 0, 0, 0,  0, 0, 0, 0,	/* nlmsghdr, NLM_F_REQUEST */
+	4, 1, 0, 0,						/* genlmsghdr, version 1 */
+	5, 0, 1, 0,  0, 0, 0, 0,				/* MSG_TYPE = REQUEST */
+	12, 0, 2, 0,  0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11,	/* CONTEXT */
+	28, 0, 24, 0x80,					/* FABRIC_PORT | NLA_F_NESTED */
+	8, 0, 4, 0,  0xbc, 0x0a, 0, 0,				/* FABRIC_ID */
+	5, 0, 5, 0,  1, 0, 0, 0,				/* SD_INDEX */
+	5, 0, 25, 0,  5, 0, 0, 0,				/* FABRIC_PORT_NUMBER */
+};
+
+/*
+ * FPORT_XMIT_RECV_COUNTS reply, seq 9, context 0x1122334455667788, result
+ * SUCCESS: TIMESTAMP 1000000000 behind a PAD, TX_BYTES 0x123456789 without
+ * one and RX_BYTES 0x42 behind a PAD.
+ */
+static const __u8 iaf_nl_golden_counts_rsp[] __attribute__((aligned(4))) = {
+	92, 0, 0, 0,  0x20, 0,  0, 0,  9, 0, 0, 0,  0, 0, 0, 0,	/* nlmsghdr */
+	19, 1, 0, 0,						/* genlmsghdr, version 1 */
+	5, 0, 1, 0,  1, 0, 0, 0,				/* MSG_TYPE = RESPONSE */
+	12, 0, 2, 0,  0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11,	/* CONTEXT */
+	5, 0, 3, 0,  0, 0, 0, 0,				/* RESULT = SUCCESS */
+	4, 0, 6, 0,						/* PAD */
+	12, 0, 73, 0,  0x00, 0xca, 0x9a, 0x3b, 0, 0, 0, 0,	/* TIMESTAMP */
+	12, 0, 74, 0,  0x89, 0x67, 0x45, 0x23, 0x01, 0, 0, 0,	/* FPORT_TX_BYTES */
+	4, 0, 6, 0,						/* PAD */
+	12, 0, 75, 0,  0x42, 0, 0, 0, 0, 0, 0, 0,		/* FPORT_RX_BYTES */
+};
+
+/* PORT_STATE_QUERY reply, seq 8, context 1, result PORT_RANGE_ERROR */
+static const __u8 iaf_nl_golden_range_rsp[] __attribute__((aligned(4))) = {
+	48, 0, 0, 0,  0x20, 0,  0, 0,  8, 0, 0, 0,  0, 0, 0, 0,	/* nlmsghdr */
+	4, 1, 0, 0,						/* genlmsghdr, version 1 */
+	5, 0, 1, 0,  1, 0, 0, 0,				/* MSG_TYPE = RESPONSE */
+	12, 0, 2, 0,  1, 0, 0, 0, 0, 0, 0, 0,			/* CONTEXT */
+	5, 0, 3, 0,  11, 0, 0, 0,				/* RESULT */
+};
+
+/* Acknowledgement of the request above: NLMSG_ERROR with error 0 */
+static const __u8 iaf_nl_golden_ack[] __attribute__((aligned(4))) = {
+	36, 0, 0, 0,  2, 0,  0x00, 0x01,  7, 0, 0, 0,  0, 0, 0, 0,	/* NLMSG_ERROR, NLM_F_CAPPED */
+	0, 0, 0, 0,						/* error */
+	68, 0, 0, 0,  0x20, 0,  1, 0,  7, 0, 0, 0,  0, 0, 0, 0,	/* request header */
+};
+
+/* Rejection of an unknown command: NLMSG_ERROR with -EOPNOTSUPP (-95) */
+static const __u8 iaf_nl_golden_eopnotsupp[] __attribute__((aligned(4))) = {
+	36, 0, 0, 0,  2, 0,  0x00, 0x01,  7, 0, 0, 0,  0, 0, 0, 0,	/* NLMSG_ERROR, NLM_F_CAPPED */
+	0xa1, 0xff, 0xff, 0xff,					/* error */
+	68, 0, 0, 0,  0x20, 0,  1, 0,  7, 0, 0, 0,  0, 0, 0, 0,	/* request header */
+};
+
+static inline int
+__iaf_nl_golden_parse(const __u8 *buf, __u32 len, struct iaf_nl_reply *reply)
+{
+	const struct nlmsghdr *nlh;
+	__u32 off = 0;
+
+	nlh = iaf_nl_msg_next(buf, len, &off);
+	if (!nlh || off != len)
+		return -EBADMSG;
+
+	return iaf_nl_reply_parse(nlh, reply);
+}
+
+/**
+ * iaf_nl_golden_check - Run the codec against the golden messages
+ *
+ * Return: 0 if every message encodes and decodes as expected, otherwise
+ * the source line of the first failed check.
+ */
+static inline int
+iaf_nl_golden_check(void)
+{
+	__u8 buf[128] __attribute__((aligned(4)));
+	struct iaf_nl_reply reply;
+	struct iaf_nl_iter it;
+	struct iaf_nl_attr attr;
+	struct iaf_nl_msg msg;
+	__u64 counts[3] = { 0, 0, 0 };
+	int len;
+
+	iaf_nl_msg_init(&msg, buf, sizeof(buf), 0x20,
+			IAF_CMD_OP_PORT_STATE_QUERY, 7, 0x1122334455667788ull);
+	iaf_nl_put_port(&msg, 0xabc, 1, 5);
+	len = iaf_nl_msg_finish(&msg);
+	if (len != sizeof(iaf_nl_golden_port_state_req) ||
+	    memcmp(buf, iaf_nl_golden_port_state_req, len))
+		return __LINE__;
+
+	if (__iaf_nl_golden_parse(iaf_nl_golden_counts_rsp,
+				  sizeof(iaf_nl_golden_counts_rsp), &reply) ||
+	    reply.seq != 9 || reply.op != IAF_CMD_OP_FPORT_XMIT_RECV_COUNTS ||
+	    reply.context != 0x1122334455667788ull)
+		return __LINE__;
+
+	iaf_nl_iter_init(&it, reply.attrs, reply.attrs_len);
+	while ((len = iaf_nl_iter_next(&it, &attr)) > 0) {
+		if (attr.type >= IAF_ATTR_TIMESTAMP &&
+		    attr.type <= IAF_ATTR_FPORT_RX_BYTES)
+			counts[attr.type - IAF_ATTR_TIMESTAMP] = iaf_nl_attr_uint(&attr);
+		else if (attr.type == IAF_ATTR_PAD)
+			return __LINE__;
+	}
+	if (len || counts[0] != 1000000000ull || counts[1] != 0x123456789ull ||
+	    counts[2] != 0x42)
+		return __LINE__;
+
+	if (__iaf_nl_golden_parse(iaf_nl_golden_range_rsp,
+				  sizeof(iaf_nl_golden_range_rsp), &reply) != -ERANGE ||
+	    reply.result != IAF_CMD_RSP_PORT_RANGE_ERROR || reply.seq != 8)
+		return __LINE__;
+
+	if (__iaf_nl_golden_parse(iaf_nl_golden_ack, sizeof(iaf_nl_golden_ack),
+				  &reply) != IAF_NL_ACK || reply.seq != 7)
+		return __LINE__;
+
+	if (__iaf_nl_golden_parse(iaf_nl_golden_eopnotsupp,
+				  sizeof(iaf_nl_golden_eopnotsupp), &reply) != -EOPNOTSUPP)
+		return __LINE__;
+
+	return 0;
+}
+
+#endif /* _IAF_NL_GOLDEN_H_ */
@@ -0,0 +1,493 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _IAF_THROUGHPUT_H_
+#define _IAF_THROUGHPUT_H_
+
+#include <errno.h>
+#include <string.h>
+
+#include "iaf_nl_codec.h"
+
+/**
+ * DOC: Fabric port throughput sampler
+ *
+ * struct iaf_tp_sampler polls %IAF_CMD_OP_FPORT_THROUGHPUT for a set of
+ * ports. One round encodes all the requests back to back into one buffer,
+ * each carrying up to @ports_per_msg %IAF_ATTR_FABRIC_PORT nests, so the
+ * whole round is a single send(). Replies are matched to their request by
+ * netlink sequence number and may arrive in any order and any grouping.
+ *
+ * Each reply carries %IAF_ATTR_FPORT_TX_BYTES, %IAF_ATTR_FPORT_RX_BYTES and
+ * the device %IAF_ATTR_TIMESTAMP, either nested per port in
+ * %IAF_ATTR_FABRIC_PORT_THROUGHPUT or, for single-port replies, at the top
+ * level. Rates are computed from the device timestamp rather than the time
+ * of the reply, so jitter in the round trip does not show up as bandwidth
+ * noise. Byte counter deltas are taken modulo 2^@counter_bits, so a wrap
+ * between two samples still gives the right rate. The timestamp is a 64-bit
+ * nanosecond clock and its delta is always taken at full width.
+ *
+ * The samples of each port go into a fixed-size ring embedded in struct
+ * iaf_tp_port, overwriting the oldest one, so sampling never allocates.
+ */
+
+#ifndef IAF_TP_RING_SIZE
+#define IAF_TP_RING_SIZE	128
+#endif
+
+#define IAF_TP_MAX_MSGS		256
+
+/**
+ * struct iaf_tp_sample - One throughput sample
+ */
+struct iaf_tp_sample {
+	/** @timestamp: Device timestamp, in ns */
+	__u64 timestamp;
+
+	__u64 tx_bytes;
+	__u64 rx_bytes;
+
+	/** @tx_rate: Bytes per second since the previous sample */
+	__u64 tx_rate;
+
+	/** @rx_rate: Bytes per second since the previous sample */
+	__u64 rx_rate;
+};
+
+/**
+ * struct iaf_tp_port - Sampled port
+ */
+struct iaf_tp_port {
+	__u32 fabric_id;
+	__u8 sd_index;
+	__u8 port;
+
+	/** @primed: A first reading has been taken */
+	__u8 primed;
+
+	__u8 pad;
+
+	/** @count: Samples written so far, the ring holds the last ones */
+	__u64 count;
+
+	struct iaf_tp_sample last;
+	struct iaf_tp_sample ring[IAF_TP_RING_SIZE];
+};
+
+/**
+ * struct iaf_tp_sampler - Sampler state
+ */
+struct iaf_tp_sampler {
+	struct iaf_tp_port *ports;
+	__u32 num_ports;
+	__u32 ports_per_msg;
+	__u16 family;
+	__u16 pad;
+
+	/** @counter_bits: Width of the hardware byte counters */
+	__u32 counter_bits;
+
+	/** @seq: Sequence number of the first request of the round */
+	__u32 seq;
+
+	/** @num_msgs: Requests in the round */
+	__u32 num_msgs;
+
+	/** @pending: Requests of the round still waiting for a reply */
+	__u32 pending;
+
+	/** @errors: Replies with an error */
+	__u64 errors;
+
+	/** @stale: Replies not matching a pending request */
+	__u64 stale;
+
+	__u64 outstanding[IAF_TP_MAX_MSGS / 64];
+};
+
+/**
+ * iaf_tp_init - Initialise a sampler
+ * @s: sampler
+ * @ports: ports to sample, with @fabric_id, @sd_index and @port set
+ * @num_ports: number of entries in @ports
+ * @family: IAF family id
+ * @ports_per_msg: ports batched in one request, at least 1
+ * @counter_bits: width of the byte counters, 64 if they do not wrap early
+ *
+ * Return: 0 on success, -EINVAL for bad parameters or -E2BIG if a round
+ * would need more than %IAF_TP_MAX_MSGS requests.
+ */
+static inline int
+iaf_tp_init(struct iaf_tp_sampler *s, struct iaf_tp_port *ports,
+	    __u32 num_ports, __u16 family, __u32 ports_per_msg,
+	    __u32 counter_bits)
+{
+	__u32 i;
+
+	if (!ports_per_msg || !counter_bits || counter_bits > 64)
+		return -EINVAL;
+	if ((num_ports + ports_per_msg - 1) / ports_per_msg > IAF_TP_MAX_MSGS)
+		return -E2BIG;
+
+	memset(s, 0, sizeof(*s));
+	s->ports = ports;
+	s->num_ports = num_ports;
+	s->family = family;
+	s->ports_per_msg = ports_per_msg;
+	s->counter_bits = counter_bits;
+
+	for (i = 0; i < num_ports; i++) {
+		ports[i].primed = 0;
+		ports[i].count = 0;
+	}
+
+	return 0;
+}
+
+/**
+ * iaf_tp_delta - Difference of two readings of a wrapping counter
+ * @cur: current reading
+ * @prev: previous reading
+ * @bits: counter width
+ */
+static inline __u64
+iaf_tp_delta(__u64 cur, __u64 prev, __u32 bits)
+{
+	__u64 mask = bits < 64 ? (1ull << bits) - 1 : ~0ull;
+
+	return (cur - prev) & mask;
+}
+
+/**
+ * iaf_tp_rate - Bytes per second from a byte and a nanosecond delta
+ * @bytes: byte delta
+ * @ns: time delta, non-zero
+ */
+static inline __u64
+iaf_tp_rate(__u64 bytes, __u64 ns)
+{
+#ifdef __SIZEOF_INT128__
+	return (unsigned __int128)bytes * 1000000000u / ns;
+#else
+	return bytes / ns * 1000000000u + bytes % ns * 1000000000u / ns;
+#endif
+}
+
+/**
+ * iaf_tp_encode - Encode the requests of one round
+ * @s: sampler
+ * @buf: destination, 4-byte aligned
+ * @size: size of @buf
+ * @seq: sequence number of the first request; the round uses @seq up to
+ *	 @seq + number of requests - 1
+ *
+ * Starting a round forgets the replies still pending from the previous
+ * one; they are counted as stale if they show up later.
+ *
+ * Return: the number of bytes to send, or -EMSGSIZE.
+ */
+static inline int
+iaf_tp_encode(struct iaf_tp_sampler *s, void *buf, __u32 size, __u32 seq)
+{
+	__u8 *p = (__u8 *)buf;
+	__u32 len = 0, first, i;
+
+	s->seq = seq;
+	s->num_msgs = 0;
+	s->pending = 0;
+	memset(s->outstanding, 0, sizeof(s->outstanding));
+
+	for (first = 0; first < s->num_ports; first += s->ports_per_msg) {
+		struct iaf_nl_msg msg;
+		__u32 last = first + s->ports_per_msg;
+		int ret;
+
+		if (last > s->num_ports)
+			last = s->num_ports;
+
+		iaf_nl_msg_init(&msg, p + len, size - len, s->family,
+				IAF_CMD_OP_FPORT_THROUGHPUT, seq + s->num_msgs,
+				first);
+		for (i = first; i < last; i++)
+			iaf_nl_put_port(&msg, s->ports[i].fabric_id,
+					s->ports[i].sd_index, s->ports[i].port);
+		ret = iaf_nl_msg_finish(&msg);
+		if (ret < 0)
+			return ret;
+
+		len += ret;
+		s->outstanding[s->num_msgs / 64] |= 1ull << (s->num_msgs % 64);
+		s->num_msgs++;
+	}
+	s->pending = s->num_msgs;
+
+	return len;
+}
+
+static inline void
+__iaf_tp_record(struct iaf_tp_sampler *s, struct iaf_tp_port *port,
+		__u64 ts, __u64 tx, __u64 rx)
+{
+	struct iaf_tp_sample *sample;
+	__u64 dt;
+
+	if (!port->primed) {
+		port->last.timestamp = ts;
+		port->last.tx_bytes = tx;
+		port->last.rx_bytes = rx;
+		port->primed = 1;
+		return;
+	}
+
+	/* Same device timestamp, the counters did not move either */
+	dt = ts - port->last.timestamp;
+	if (!dt)
+		return;
+
+	sample = &port->ring[port->count % IAF_TP_RING_SIZE];
+	sample->timestamp = ts;
+	sample->tx_bytes = tx;
+	sample->rx_bytes = rx;
+	sample->tx_rate = iaf_tp_rate(iaf_tp_delta(tx, port->last.tx_bytes, s->counter_bits), dt);
+	sample->rx_rate = iaf_tp_rate(iaf_tp_delta(rx, port->last.rx_bytes, s->counter_bits), dt);
+	port->last = *sample;
+	port->count++;
+}
+
+struct __iaf_tp_reading {
+	__u64 fabric_id;
+	__u64 sd_index;
+	__u64 port;
+	__u64 ts;
+	__u64 tx;
+	__u64 rx;
+	unsigned int have;
+#define __IAF_TP_FABRIC_ID	(1 << 0)
+#define __IAF_TP_SD_INDEX	(1 << 1)
+#define __IAF_TP_PORT		(1 << 2)
+#define __IAF_TP_TS		(1 << 3)
+#define __IAF_TP_TX		(1 << 4)
+#define __IAF_TP_RX		(1 << 5)
+#define __IAF_TP_COUNTS		(__IAF_TP_TS | __IAF_TP_TX | __IAF_TP_RX)
+};
+
+static inline void
+__iaf_tp_reading_add(struct __iaf_tp_reading *r, const struct iaf_nl_attr *attr)
+{
+	switch (attr->type) {
+	case IAF_ATTR_FABRIC_ID:
+		r->fabric_id = iaf_nl_attr_uint(attr);
+		r->have |= __IAF_TP_FABRIC_ID;
+		break;
+	case IAF_ATTR_SD_INDEX:
+		r->sd_index = iaf_nl_attr_uint(attr);
+		r->have |= __IAF_TP_SD_INDEX;
+		break;
+	case IAF_ATTR_FABRIC_PORT_NUMBER:
+		r->port = iaf_nl_attr_uint(attr);
+		r->have |= __IAF_TP_PORT;
+		break;
+	case IAF_ATTR_TIMESTAMP:
+		r->ts = iaf_nl_attr_uint(attr);
+		r->have |= __IAF_TP_TS;
+		break;
+	case IAF_ATTR_FPORT_TX_BYTES:
+		r->tx = iaf_nl_attr_uint(attr);
+		r->have |= __IAF_TP_TX;
+		break;
+	case IAF_ATTR_FPORT_RX_BYTES:
+		r->rx = iaf_nl_attr_uint(attr);
+		r->have |= __IAF_TP_RX;
+		break;
+	}
+}
+
+/* Find the port of a reading among the ports of one request */
+static inline struct iaf_tp_port *
+__iaf_tp_match(struct iaf_tp_sampler *s, __u32 first,
+	       const struct __iaf_tp_reading *r)
+{
+	__u32 i, last = first + s->ports_per_msg;
+
+	if (last > s->num_ports)
+		last = s->num_ports;
+
+	for (i = first; i < last; i++) {
+		struct iaf_tp_port *p = &s->ports[i];
+
+		if (r->have & __IAF_TP_PORT && r->port != p->port)
+			continue;
+		if (r->have & __IAF_TP_FABRIC_ID && r->fabric_id != p->fabric_id)
+			continue;
+		if (r->have & __IAF_TP_SD_INDEX && r->sd_index != p->sd_index)
+			continue;
+		return p;
+	}
+
+	return NULL;
+}
+
+/**
+ * iaf_tp_decode - Consume received replies
+ * @s: sampler
+ * @buf: data returned by recv(), 4-byte aligned
+ * @len: number of bytes in @buf
+ *
+ * Return: the number of port readings taken, or -EBADMSG if @buf is not a
+ * sequence of netlink messages. Failed and unexpected replies are only
+ * counted in &iaf_tp_sampler.errors and &iaf_tp_sampler.stale.
+ */
+static inline int
+iaf_tp_decode(struct iaf_tp_sampler *s, const void *buf, __u32 len)
+{
+	const struct nlmsghdr *nlh;
+	__u32 off = 0;
+	int readings = 0;
+
+	while ((nlh = iaf_nl_msg_next(buf, len, &off))) {
+		struct iaf_nl_reply reply;
+		struct __iaf_tp_reading top;
+		struct iaf_nl_iter it;
+		struct iaf_nl_attr attr;
+		__u32 idx = nlh->nlmsg_seq - s->seq;
+		int ret;
+
+		if (idx >= s->num_msgs ||
+		    !(s->outstanding[idx / 64] >> (idx % 64) & 1)) {
+			s->stale++;
+			continue;
+		}
+		s->outstanding[idx / 64] &= ~(1ull << (idx % 64));
+		s->pending--;
+
+		ret = iaf_nl_reply_parse(nlh, &reply);
+		if (ret) {
+			s->errors++;
+			continue;
+		}
+
+		memset(&top, 0, sizeof(top));
+		iaf_nl_iter_init(&it, reply.attrs, reply.attrs_len);
+		while (iaf_nl_iter_next(&it, &attr) > 0) {
+			struct __iaf_tp_reading r;
+			struct iaf_tp_port *port;
+			struct iaf_nl_iter in;
+
+			if (attr.type != IAF_ATTR_FABRIC_PORT_THROUGHPUT) {
+				__iaf_tp_reading_add(&top, &attr);
+				continue;
+			}
+
+			memset(&r, 0, sizeof(r));
+			iaf_nl_attr_nested(&attr, &in);
+			while (iaf_nl_iter_next(&in, &attr) > 0)
+				__iaf_tp_reading_add(&r, &attr);
+
+			/* A nested reading must say which port it belongs to */
+			port = NULL;
+			if (r.have & __IAF_TP_PORT)
+				port = __iaf_tp_match(s, idx * s->ports_per_msg, &r);
+			if (!port || (r.have & __IAF_TP_COUNTS) != __IAF_TP_COUNTS) {
+				s->errors++;
+				continue;
+			}
+			__iaf_tp_record(s, port, r.ts, r.tx, r.rx);
+			readings++;
+		}
+
+		/* Single port reply with the counters at the top level */
+		if ((top.have & __IAF_TP_COUNTS) == __IAF_TP_COUNTS) {
+			struct iaf_tp_port *port =
+				__iaf_tp_match(s, idx * s->ports_per_msg, &top);
+
+			if (port) {
+				__iaf_tp_record(s, port, top.ts, top.tx, top.rx);
+				readings++;
+			} else {
+				s->errors++;
+			}
+		}
+	}
+
+	return off == len ? readings : -EBADMSG;
+}
+
+/**
+ * iaf_tp_latest - Most recent sample of a port
+ * @port: port
+ * @back: 0 for the latest sample, 1 for the one before, ...
+ *
+ * Return: the sample, or NULL if it was not taken or already overwritten.
+ */
+static inline const struct iaf_tp_sample *
+iaf_tp_latest(const struct iaf_tp_port *port, __u32 back)
+{
+	if (back >= port->count || back >= IAF_TP_RING_SIZE)
+		return NULL;
+
+	return &port->ring[(port->count - 1 - back) % IAF_TP_RING_SIZE];
+}
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/socket.h>
+
+/**
+ * iaf_tp_round - Run one sampling round on a netlink socket
+ * @s: sampler
+ * @fd: generic netlink socket, or any datagram socket speaking the protocol
+ * @buf: scratch buffer for both the requests and the replies, 4-byte aligned
+ * @size: size of @buf
+ * @seq: first sequence number of the round
+ * @timeout_ms: time to wait for each batch of replies
+ *
+ * Return: the number of port readings taken, -ETIME if replies are still
+ * pending after @timeout_ms without traffic, or another negative error code.
+ */
+static inline int
+iaf_tp_round(struct iaf_tp_sampler *s, int fd, void *buf, __u32 size,
+	     __u32 seq, int timeout_ms)
+{
+	int len, ret, readings = 0;
+	ssize_t n;
+
+	len = iaf_tp_encode(s, buf, size, seq);
+	if (len < 0)
+		return len;
+
+	do {
+		n = send(fd, buf, len, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return -errno;
+
+	while (s->pending) {
+		struct pollfd pfd = { fd, POLLIN, 0 };
+
+		ret = poll(&pfd, 1, timeout_ms);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+		if (!ret)
+			return -ETIME;
+
+		n = recv(fd, buf, size, MSG_DONTWAIT);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n < 0)
+			return -errno;
+
+		ret = iaf_tp_decode(s, buf, n);
+		if (ret < 0)
+			return ret;
+		readings += ret;
+	}
+
+	return readings;
+}
+#endif
+
+#endif /* _IAF_THROUGHPUT_H_ */
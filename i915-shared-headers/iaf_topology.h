@@ -0,0 +1,464 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _IAF_TOPOLOGY_H_
+#define _IAF_TOPOLOGY_H_
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iaf_nl_codec.h"
+
+/**
+ * DOC: Fabric topology graph
+ *
+ * Every sub-device reports its %IAF_ATTR_GUID, and every fabric port reports
+ * the %IAF_ATTR_FPORT_NEIGHBOR_GUID and %IAF_ATTR_FPORT_NEIGHBOR_PORT_NUMBER
+ * at the other end of its link. struct iaf_topo collects these into a graph
+ * with one node per sub-device and one directed edge per connected port, in
+ * compressed adjacency arrays: the edges leaving node n are
+ * @links[@first[n]] up to @links[@first[n + 1]].
+ *
+ * Build it by adding every sub-device with iaf_topo_add_node() and every
+ * port with iaf_topo_add_port(), or iaf_topo_add_port_attrs() straight from
+ * an %IAF_CMD_OP_FPORT_PROPERTIES reply, then call iaf_topo_finalize().
+ * Ports whose neighbour is not a known sub-device, or not connected, are
+ * left out.
+ *
+ * The fabric routes along minimal paths, so iaf_topo_query() reports the
+ * hop count of the shortest route and the best bottleneck bandwidth among
+ * the routes of that length. Edge bandwidth is
+ * %IAF_ATTR_FPORT_BPS_LINK_SPEED_ACTIVE times the lane count of
+ * %IAF_ATTR_FPORT_LINK_WIDTH_ACTIVE. All results from one source are
+ * computed in a single pass and cached until the source or the graph
+ * changes.
+ *
+ * The graph only has to be rebuilt when routing changes. Pass the
+ * %IAF_CMD_OP_ROUTING_GEN_QUERY result to iaf_topo_check_gen() before using
+ * it.
+ */
+
+/**
+ * struct iaf_topo_node - One sub-device
+ */
+struct iaf_topo_node {
+	__u64 guid;
+	__u32 fabric_id;
+	__u8 sd_index;
+	__u8 pad[3];
+};
+
+/**
+ * struct iaf_topo_link - One fabric port link
+ *
+ * Before iaf_topo_finalize() only the GUIDs are set; afterwards @from and
+ * @to index &iaf_topo.nodes.
+ */
+struct iaf_topo_link {
+	__u64 guid;
+	__u64 peer_guid;
+
+	/** @bps: Usable bits per second */
+	__u64 bps;
+
+	__u32 from;
+	__u32 to;
+	__u8 port;
+	__u8 peer_port;
+	__u8 pad[6];
+};
+
+/**
+ * struct iaf_topo - Fabric graph and query cache
+ *
+ * All arrays are owned by the caller: @nodes and the cache arrays @hops,
+ * @bw and @queue hold @max_nodes entries, @first holds @max_nodes + 1 and
+ * @links holds @max_links.
+ */
+struct iaf_topo {
+	struct iaf_topo_node *nodes;
+	__u32 num_nodes;
+	__u32 max_nodes;
+
+	struct iaf_topo_link *links;
+	__u32 num_links;
+	__u32 max_links;
+
+	__u32 *first;
+
+	/** @generation: Routing generation the graph was built for */
+	__u32 generation;
+
+	/** @built: iaf_topo_finalize() succeeded */
+	__u32 built;
+
+	/** @cache_src: Source of the cached results, ~0 if none */
+	__u32 cache_src;
+
+	__u32 *hops;
+	__u64 *bw;
+	__u32 *queue;
+};
+
+#define IAF_TOPO_UNREACHABLE	(~0u)
+
+static inline void
+iaf_topo_init(struct iaf_topo *t, struct iaf_topo_node *nodes,
+	      __u32 *first, __u32 *hops, __u64 *bw, __u32 *queue,
+	      __u32 max_nodes, struct iaf_topo_link *links, __u32 max_links)
+{
+	memset(t, 0, sizeof(*t));
+	t->nodes = nodes;
+	t->max_nodes = max_nodes;
+	t->links = links;
+	t->max_links = max_links;
+	t->first = first;
+	t->hops = hops;
+	t->bw = bw;
+	t->queue = queue;
+	t->cache_src = ~0u;
+}
+
+/**
+ * iaf_topo_reset - Drop the graph before a rebuild
+ * @t: topology
+ */
+static inline void
+iaf_topo_reset(struct iaf_topo *t)
+{
+	t->num_nodes = 0;
+	t->num_links = 0;
+	t->built = 0;
+	t->cache_src = ~0u;
+}
+
+/**
+ * iaf_topo_add_node - Add a sub-device
+ * @t: topology being built
+ * @guid: %IAF_ATTR_GUID
+ * @fabric_id: %IAF_ATTR_FABRIC_ID
+ * @sd_index: %IAF_ATTR_SD_INDEX
+ *
+ * Return: 0 on success or -ENOSPC.
+ */
+static inline int
+iaf_topo_add_node(struct iaf_topo *t, __u64 guid, __u32 fabric_id,
+		  __u8 sd_index)
+{
+	struct iaf_topo_node *n;
+
+	if (t->num_nodes == t->max_nodes)
+		return -ENOSPC;
+
+	n = &t->nodes[t->num_nodes++];
+	memset(n, 0, sizeof(*n));
+	n->guid = guid;
+	n->fabric_id = fabric_id;
+	n->sd_index = sd_index;
+	t->built = 0;
+
+	return 0;
+}
+
+/**
+ * iaf_topo_link_lanes - Lane count of %IAF_ATTR_FPORT_LINK_WIDTH_ACTIVE
+ * @width: one-hot width, bit n meaning n + 1 lanes
+ *
+ * Return: the number of lanes, 0 if no lane is active.
+ */
+static inline __u32
+iaf_topo_link_lanes(__u64 width)
+{
+	return width ? 64 - __builtin_clzll(width) : 0;
+}
+
+/**
+ * iaf_topo_add_port - Add a connected port
+ * @t: topology being built
+ * @guid: GUID of the sub-device owning the port
+ * @port: %IAF_ATTR_FABRIC_PORT_NUMBER
+ * @peer_guid: %IAF_ATTR_FPORT_NEIGHBOR_GUID
+ * @peer_port: %IAF_ATTR_FPORT_NEIGHBOR_PORT_NUMBER
+ * @bps: usable bandwidth of the link in bits per second
+ *
+ * Return: 0 on success, -ENOSPC.
+ */
+static inline int
+iaf_topo_add_port(struct iaf_topo *t, __u64 guid, __u8 port, __u64 peer_guid,
+		  __u8 peer_port, __u64 bps)
+{
+	struct iaf_topo_link *l;
+
+	if (t->num_links == t->max_links)
+		return -ENOSPC;
+
+	l = &t->links[t->num_links++];
+	memset(l, 0, sizeof(*l));
+	l->guid = guid;
+	l->port = port;
+	l->peer_guid = peer_guid;
+	l->peer_port = peer_port;
+	l->bps = bps;
+	t->built = 0;
+
+	return 0;
+}
+
+/**
+ * iaf_topo_add_port_attrs - Add a port from its %IAF_ATTR_FABRIC_PORT nest
+ * @t: topology being built
+ * @guid: GUID of the sub-device owning the port
+ * @port_attr: %IAF_ATTR_FABRIC_PORT attribute of a port properties reply
+ *
+ * Ports without a neighbour or without an active link are skipped.
+ *
+ * Return: 1 if the port was added, 0 if it was skipped, -ENOSPC.
+ */
+static inline int
+iaf_topo_add_port_attrs(struct iaf_topo *t, __u64 guid,
+			const struct iaf_nl_attr *port_attr)
+{
+	__u64 port = 0, peer_guid = 0, peer_port = 0, bps = 0, width = 0;
+	struct iaf_nl_iter it;
+	struct iaf_nl_attr attr;
+	int ret;
+
+	iaf_nl_attr_nested(port_attr, &it);
+	while (iaf_nl_iter_next(&it, &attr) > 0) {
+		switch (attr.type) {
+		case IAF_ATTR_FABRIC_PORT_NUMBER:
+			port = iaf_nl_attr_uint(&attr);
+			break;
+		case IAF_ATTR_FPORT_NEIGHBOR_GUID:
+			peer_guid = iaf_nl_attr_uint(&attr);
+			break;
+		case IAF_ATTR_FPORT_NEIGHBOR_PORT_NUMBER:
+			peer_port = iaf_nl_attr_uint(&attr);
+			break;
+		case IAF_ATTR_FPORT_BPS_LINK_SPEED_ACTIVE:
+			bps = iaf_nl_attr_uint(&attr);
+			break;
+		case IAF_ATTR_FPORT_LINK_WIDTH_ACTIVE:
+			width = iaf_nl_attr_uint(&attr);
+			break;
+		}
+	}
+
+	if (!peer_guid || !bps || !width)
+		return 0;
+
+	ret = iaf_topo_add_port(t, guid, port, peer_guid, peer_port,
+				bps * iaf_topo_link_lanes(width));
+	return ret ? ret : 1;
+}
+
+static inline int
+__iaf_topo_cmp_node(const void *a, const void *b)
+{
+	__u64 x = ((const struct iaf_topo_node *)a)->guid;
+	__u64 y = ((const struct iaf_topo_node *)b)->guid;
+
+	return x < y ? -1 : x > y;
+}
+
+static inline int
+__iaf_topo_cmp_link(const void *a, const void *b)
+{
+	const struct iaf_topo_link *x = (const struct iaf_topo_link *)a;
+	const struct iaf_topo_link *y = (const struct iaf_topo_link *)b;
+
+	if (x->from != y->from)
+		return x->from < y->from ? -1 : 1;
+	return x->port < y->port ? -1 : x->port > y->port;
+}
+
+/**
+ * iaf_topo_find - Node index of a sub-device
+ * @t: finalized topology
+ * @guid: %IAF_ATTR_GUID
+ *
+ * Return: the index into &iaf_topo.nodes, or -ENOENT.
+ */
+static inline long
+iaf_topo_find(const struct iaf_topo *t, __u64 guid)
+{
+	__u32 lo = 0, hi = t->num_nodes;
+
+	while (lo < hi) {
+		__u32 mid = lo + (hi - lo) / 2;
+
+		if (t->nodes[mid].guid < guid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < t->num_nodes && t->nodes[lo].guid == guid ? (long)lo : -ENOENT;
+}
+
+/**
+ * iaf_topo_finalize - Build the adjacency arrays
+ * @t: topology
+ * @generation: routing generation the ports were read at
+ *
+ * Sorts the nodes by GUID, so node indices are only stable until the next
+ * rebuild, and drops links that do not lead to a known node.
+ *
+ * Return: 0 on success, -EEXIST if two sub-devices share a GUID.
+ */
+static inline int
+iaf_topo_finalize(struct iaf_topo *t, __u32 generation)
+{
+	__u32 i, n = 0;
+
+	qsort(t->nodes, t->num_nodes, sizeof(*t->nodes), __iaf_topo_cmp_node);
+	for (i = 1; i < t->num_nodes; i++) {
+		if (t->nodes[i].guid == t->nodes[i - 1].guid)
+			return -EEXIST;
+	}
+
+	for (i = 0; i < t->num_links; i++) {
+		struct iaf_topo_link *l = &t->links[i];
+		long from = iaf_topo_find(t, l->guid);
+		long to = iaf_topo_find(t, l->peer_guid);
+
+		if (from < 0 || to < 0 || from == to)
+			continue;
+
+		l->from = from;
+		l->to = to;
+		t->links[n++] = *l;
+	}
+	t->num_links = n;
+	qsort(t->links, t->num_links, sizeof(*t->links), __iaf_topo_cmp_link);
+
+	memset(t->first, 0, (t->num_nodes + 1) * sizeof(*t->first));
+	for (i = 0; i < t->num_links; i++)
+		t->first[t->links[i].from + 1]++;
+	for (i = 0; i < t->num_nodes; i++)
+		t->first[i + 1] += t->first[i];
+
+	t->generation = generation;
+	t->built = 1;
+	t->cache_src = ~0u;
+
+	return 0;
+}
+
+/**
+ * iaf_topo_routing_gen - Decode an %IAF_CMD_OP_ROUTING_GEN_QUERY reply
+ * @reply: parsed reply
+ * @start: returns %IAF_ATTR_ROUTING_GEN_START
+ * @end: returns %IAF_ATTR_ROUTING_GEN_END
+ *
+ * Return: 0 on success, -EBADMSG if an attribute is missing.
+ */
+static inline int
+iaf_topo_routing_gen(const struct iaf_nl_reply *reply, __u32 *start, __u32 *end)
+{
+	struct iaf_nl_iter it;
+	struct iaf_nl_attr attr;
+	int have = 0;
+
+	iaf_nl_iter_init(&it, reply->attrs, reply->attrs_len);
+	while (iaf_nl_iter_next(&it, &attr) > 0) {
+		if (attr.type == IAF_ATTR_ROUTING_GEN_START) {
+			*start = iaf_nl_attr_uint(&attr);
+			have |= 1;
+		} else if (attr.type == IAF_ATTR_ROUTING_GEN_END) {
+			*end = iaf_nl_attr_uint(&attr);
+			have |= 2;
+		}
+	}
+
+	return have == 3 ? 0 : -EBADMSG;
+}
+
+/**
+ * iaf_topo_check_gen - Decide whether the graph must be rebuilt
+ * @t: topology
+ * @start: %IAF_ATTR_ROUTING_GEN_START
+ * @end: %IAF_ATTR_ROUTING_GEN_END
+ *
+ * Return: 0 if the graph is current, 1 if it must be rebuilt, -EAGAIN if
+ * routing is being updated (@start != @end) and the fabric should be read
+ * again later.
+ */
+static inline int
+iaf_topo_check_gen(const struct iaf_topo *t, __u32 start, __u32 end)
+{
+	if (start != end)
+		return -EAGAIN;
+
+	return !t->built || t->generation != end;
+}
+
+/* Hops and bottleneck bandwidth from @src to every node, in one BFS */
+static inline void
+__iaf_topo_from(struct iaf_topo *t, __u32 src)
+{
+	__u32 head = 0, tail = 0, i;
+
+	for (i = 0; i < t->num_nodes; i++) {
+		t->hops[i] = IAF_TOPO_UNREACHABLE;
+		t->bw[i] = 0;
+	}
+	t->hops[src] = 0;
+	t->bw[src] = ~0ull;
+	t->queue[tail++] = src;
+
+	while (head < tail) {
+		__u32 u = t->queue[head++];
+
+		for (i = t->first[u]; i < t->first[u + 1]; i++) {
+			const struct iaf_topo_link *l = &t->links[i];
+			__u64 b = l->bps < t->bw[u] ? l->bps : t->bw[u];
+
+			if (t->hops[l->to] == IAF_TOPO_UNREACHABLE) {
+				t->hops[l->to] = t->hops[u] + 1;
+				t->queue[tail++] = l->to;
+			} else if (t->hops[l->to] != t->hops[u] + 1) {
+				continue;
+			}
+
+			/* Best bottleneck among the minimal routes */
+			if (b > t->bw[l->to])
+				t->bw[l->to] = b;
+		}
+	}
+
+	t->cache_src = src;
+}
+
+/**
+ * iaf_topo_query - Route metrics between two sub-devices
+ * @t: finalized topology
+ * @src: source node index
+ * @dst: destination node index
+ * @hops: returns the hop count, %IAF_TOPO_UNREACHABLE if there is no route
+ * @bps: returns the best bottleneck bandwidth among minimal routes, 0 if
+ *	 there is no route and ~0 for @src == @dst
+ *
+ * Return: 0 on success, -EINVAL if the graph is not built or an index is
+ * out of range.
+ */
+static inline int
+iaf_topo_query(struct iaf_topo *t, __u32 src, __u32 dst, __u32 *hops,
+	       __u64 *bps)
+{
+	if (!t->built || src >= t->num_nodes || dst >= t->num_nodes)
+		return -EINVAL;
+
+	if (t->cache_src != src)
+		__iaf_topo_from(t, src);
+
+	*hops = t->hops[dst];
+	*bps = t->bw[dst];
+
+	return 0;
+}
+
+#endif /* _IAF_TOPOLOGY_H_ */
@@ -0,0 +1,369 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright © 2023 Intel Corporation
+ */
+
+#ifndef _INTEL_HWCONFIG_KLV_H_
+#define _INTEL_HWCONFIG_KLV_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <linux/types.h>
+
+#include "intel_hwconfig_types.h"
+
+/**
+ * DOC: hwconfig KLV table view
+ *
+ * The blob returned by %DRM_I915_QUERY_HWCONFIG_BLOB (and the deprecated
+ * %PRELIM_DRM_I915_QUERY_HWCONFIG_TABLE) is a sequence of dword aligned
+ * KLV entries:
+ *
+ *   .. code:: c
+ *
+ *      __u32 key;		// enum intel_hwconfig_keys
+ *      __u32 length;		// number of value dwords that follow
+ *      __u32 value[length];
+ *
+ * Rather than scanning the blob for every key, userspace can index it once
+ * with intel_hwconfig_view_init(). The view only stores pointers into the
+ * caller's buffer, so the blob must stay alive (and unmodified) for as long
+ * as the view is used. Every later lookup is a single array load.
+ *
+ * Keys outside of [1, %INTEL_HWCONFIG_MAX] are skipped so that a blob
+ * produced by newer firmware can still be indexed. If a key is repeated
+ * the last entry wins, which matches what a linear scan from the end
+ * would return.
+ */
+
+/**
+ * struct intel_hwconfig_view - Dense index over a hwconfig KLV blob
+ */
+struct intel_hwconfig_view {
+	/** @value: Pointer to the first value dword of each key, or NULL */
+	const __u32 *value[__INTEL_HWCONFIG_MAX];
+
+	/** @length: Number of value dwords available for each key */
+	__u32 length[__INTEL_HWCONFIG_MAX];
+};
+
+/**
+ * intel_hwconfig_view_init - Index a hwconfig KLV blob
+ * @view: view to fill
+ * @blob: dword aligned KLV blob as returned by the query
+ * @size: size of @blob in bytes
+ *
+ * Return: 0 on success, -EINVAL if the blob is truncated or misaligned.
+ * On error @view only contains the entries parsed before the bad one.
+ */
+static inline int
+intel_hwconfig_view_init(struct intel_hwconfig_view *view,
+			 const void *blob, __u32 size)
+{
+	const __u32 *klv = (const __u32 *)blob;
+	__u32 remain = size / sizeof(__u32);
+	__u32 i;
+
+	for (i = 0; i < __INTEL_HWCONFIG_MAX; i++) {
+		view->value[i] = NULL;
+		view->length[i] = 0;
+	}
+
+	if (size % sizeof(__u32))
+		return -EINVAL;
+
+	while (remain) {
+		__u32 key, len;
+
+		if (remain < 2)
+			return -EINVAL;
+
+		key = klv[0];
+		len = klv[1];
+		if (len > remain - 2)
+			return -EINVAL;
+
+		if (key > 0 && key < __INTEL_HWCONFIG_MAX) {
+			view->value[key] = &klv[2];
+			view->length[key] = len;
+		}
+
+		klv += 2 + len;
+		remain -= 2 + len;
+	}
+
+	return 0;
+}
+
+/**
+ * intel_hwconfig_view_has - Check whether a key is present in the table
+ * @view: indexed view
+ * @key: enum intel_hwconfig_keys value
+ */
+static inline int
+intel_hwconfig_view_has(const struct intel_hwconfig_view *view, __u32 key)
+{
+	return key < __INTEL_HWCONFIG_MAX && view->value[key];
+}
+
+/**
+ * intel_hwconfig_view_get - Read the first value dword of a key
+ * @view: indexed view
+ * @key: enum intel_hwconfig_keys value
+ * @def: value returned when @key is absent or has no value dwords
+ */
+static inline __u32
+intel_hwconfig_view_get(const struct intel_hwconfig_view *view, __u32 key,
+			__u32 def)
+{
+	if (!intel_hwconfig_view_has(view, key) || !view->length[key])
+		return def;
+
+	return view->value[key][0];
+}
+
+/**
+ * enum intel_hwconfig_unit - Unit of the first value dword of a key
+ *
+ * @INTEL_HWCONFIG_UNIT_NONE: Ratio, address or unit not documented
+ * @INTEL_HWCONFIG_UNIT_COUNT: Plain number of items
+ * @INTEL_HWCONFIG_UNIT_BYTES: Size in bytes
+ * @INTEL_HWCONFIG_UNIT_KB: Size in kilobytes
+ * @INTEL_HWCONFIG_UNIT_MB: Size in megabytes
+ * @INTEL_HWCONFIG_UNIT_MASK: Bitmask, e.g. INTEL_HWCONFIG_CACHE_TYPE_*
+ * @INTEL_HWCONFIG_UNIT_ENUM: One of the INTEL_HWCONFIG_MEMORY_TYPE_* values
+ */
+enum intel_hwconfig_unit {
+	INTEL_HWCONFIG_UNIT_NONE = 0,
+	INTEL_HWCONFIG_UNIT_COUNT,
+	INTEL_HWCONFIG_UNIT_BYTES,
+	INTEL_HWCONFIG_UNIT_KB,
+	INTEL_HWCONFIG_UNIT_MB,
+	INTEL_HWCONFIG_UNIT_MASK,
+	INTEL_HWCONFIG_UNIT_ENUM,
+};
+
+/**
+ * intel_hwconfig_key_unit - Unit of a hwconfig key
+ * @key: enum intel_hwconfig_keys value
+ *
+ * Combine with intel_hwconfig_key_type() to interpret the value.
+ */
+static inline enum intel_hwconfig_unit
+intel_hwconfig_key_unit(__u32 key)
+{
+	switch (key) {
+	case INTEL_HWCONFIG_L3_CACHE_WAYS_SIZE_IN_BYTES:
+	case INTEL_HWCONFIG_URB_REGION_ALIGNMENT_SIZE_IN_BYTES:
+	case INTEL_HWCONFIG_URB_ALLOCATION_SIZE_UNITS_IN_BYTES:
+	case INTEL_HWCONFIG_MAX_URB_SIZE_CCS_IN_BYTES:
+	case INTEL_HWCONFIG_HBM_CHANNEL_WIDTH_IN_BYTES:
+		return INTEL_HWCONFIG_UNIT_BYTES;
+	case INTEL_HWCONFIG_DEPRECATED_L3_CACHE_SIZE_IN_KB:
+	case INTEL_HWCONFIG_DEPRECATED_SLM_SIZE_IN_KB:
+	case INTEL_HWCONFIG_DEPRECATED_URB_SIZE_IN_KB:
+	case INTEL_HWCONFIG_L3_BANK_SIZE_IN_KB:
+	case INTEL_HWCONFIG_URB_SIZE_PER_SLICE_IN_KB:
+	case INTEL_HWCONFIG_URB_SIZE_PER_L3_BANK_COUNT_IN_KB:
+	case INTEL_HWCONFIG_RAMBO_L3_BANK_SIZE_IN_KB:
+	case INTEL_HWCONFIG_SLM_SIZE_PER_SS_IN_KB:
+	case INTEL_HWCONFIG_SLM_SIZE_PER_DSS:
+		return INTEL_HWCONFIG_UNIT_KB;
+	case INTEL_HWCONFIG_CSR_SIZE_IN_MB:
+		return INTEL_HWCONFIG_UNIT_MB;
+	case INTEL_HWCONFIG_CACHE_TYPES:
+	case INTEL_HWCONFIG_LOCAL_MEMORY_PAGE_SIZES_SUPPORTED:
+		return INTEL_HWCONFIG_UNIT_MASK;
+	case INTEL_HWCONFIG_MEMORY_TYPE:
+		return INTEL_HWCONFIG_UNIT_ENUM;
+	case INTEL_HWCONFIG_DEPRECATED_MAX_FILL_RATE:
+	case INTEL_HWCONFIG_PUSH_CONSTANT_URB_RESERVED_SIZE:
+	case INTEL_HWCONFIG_POCS_PUSH_CONSTANT_URB_RESERVED_SIZE:
+	case INTEL_HWCONFIG_MAX_URB_STARTING_ADDRESS:
+	case INTEL_HWCONFIG_L3_ALLOC_PER_BANK_URB:
+	case INTEL_HWCONFIG_L3_ALLOC_PER_BANK_REST:
+	case INTEL_HWCONFIG_L3_ALLOC_PER_BANK_DC:
+	case INTEL_HWCONFIG_L3_ALLOC_PER_BANK_RO:
+	case INTEL_HWCONFIG_L3_ALLOC_PER_BANK_Z:
+	case INTEL_HWCONFIG_L3_ALLOC_PER_BANK_COLOR:
+	case INTEL_HWCONFIG_L3_ALLOC_PER_BANK_UNIFIED_TILE_CACHE:
+	case INTEL_HWCONFIG_L3_ALLOC_PER_BANK_COMMAND_BUFFER:
+	case INTEL_HWCONFIG_L3_ALLOC_PER_BANK_RW:
+	case INTEL_HWCONFIG_MAX_PIXEL_FILL_RATE_PER_SLICE:
+	case INTEL_HWCONFIG_MAX_PIXEL_FILL_RATE_PER_DSS:
+		return INTEL_HWCONFIG_UNIT_NONE;
+	default:
+		return key > 0 && key < __INTEL_HWCONFIG_MAX ?
+			INTEL_HWCONFIG_UNIT_COUNT : INTEL_HWCONFIG_UNIT_NONE;
+	}
+}
+
+/**
+ * enum intel_hwconfig_value_type - Type of the value dwords of a key
+ *
+ * @INTEL_HWCONFIG_TYPE_UNKNOWN: Key outside of [1, %INTEL_HWCONFIG_MAX]
+ * @INTEL_HWCONFIG_TYPE_U32: Unsigned integer in the first dword, scaled by
+ *	the unit of the key
+ * @INTEL_HWCONFIG_TYPE_MASK: Bitmask in the first dword
+ * @INTEL_HWCONFIG_TYPE_ENUM: Enumerator in the first dword
+ */
+enum intel_hwconfig_value_type {
+	INTEL_HWCONFIG_TYPE_UNKNOWN = 0,
+	INTEL_HWCONFIG_TYPE_U32,
+	INTEL_HWCONFIG_TYPE_MASK,
+	INTEL_HWCONFIG_TYPE_ENUM,
+};
+
+/**
+ * intel_hwconfig_key_type - Value type of a hwconfig key
+ * @key: enum intel_hwconfig_keys value
+ *
+ * Every key known today carries a single dword; extra dwords reported by
+ * newer firmware are ignored by intel_hwconfig_view_get().
+ */
+static inline enum intel_hwconfig_value_type
+intel_hwconfig_key_type(__u32 key)
+{
+	switch (intel_hwconfig_key_unit(key)) {
+	case INTEL_HWCONFIG_UNIT_MASK:
+		return INTEL_HWCONFIG_TYPE_MASK;
+	case INTEL_HWCONFIG_UNIT_ENUM:
+		return INTEL_HWCONFIG_TYPE_ENUM;
+	default:
+		return key > 0 && key < __INTEL_HWCONFIG_MAX ?
+			INTEL_HWCONFIG_TYPE_U32 : INTEL_HWCONFIG_TYPE_UNKNOWN;
+	}
+}
+
+/**
+ * intel_hwconfig_key_deprecated - Check for an INTEL_HWCONFIG_DEPRECATED_* key
+ * @key: enum intel_hwconfig_keys value
+ *
+ * Deprecated keys may still be reported by older firmware but should only
+ * be used as a fallback for their replacement.
+ */
+static inline int
+intel_hwconfig_key_deprecated(__u32 key)
+{
+	switch (key) {
+	case INTEL_HWCONFIG_DEPRECATED_MAX_NUM_GEOMETRY_PIPES:
+	case INTEL_HWCONFIG_DEPRECATED_L3_CACHE_SIZE_IN_KB:
+	case INTEL_HWCONFIG_DEPRECATED_L3_BANK_COUNT:
+	case INTEL_HWCONFIG_DEPRECATED_SLM_SIZE_IN_KB:
+	case INTEL_HWCONFIG_DEPRECATED_MAX_FILL_RATE:
+	case INTEL_HWCONFIG_DEPRECATED_URB_SIZE_IN_KB:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * struct intel_hwconfig_capacity - Device capacity derived from hwconfig
+ *
+ * Filled once by intel_hwconfig_capacity_init() so that placement code can
+ * read plain fields. All values describe the maximum supported configuration
+ * reported by the firmware, not the fused-off topology; use
+ * %DRM_I915_QUERY_TOPOLOGY_INFO for the latter. A field is zero when the
+ * keys it depends on are absent.
+ */
+struct intel_hwconfig_capacity {
+	/** @slices: INTEL_HWCONFIG_MAX_SLICES_SUPPORTED */
+	__u32 slices;
+
+	/** @dual_subslices: INTEL_HWCONFIG_MAX_DUAL_SUBSLICES_SUPPORTED */
+	__u32 dual_subslices;
+
+	/** @eus_per_dss: INTEL_HWCONFIG_MAX_NUM_EU_PER_DSS */
+	__u32 eus_per_dss;
+
+	/** @threads_per_eu: INTEL_HWCONFIG_NUM_THREADS_PER_EU */
+	__u32 threads_per_eu;
+
+	/** @total_eus: @dual_subslices * @eus_per_dss */
+	__u32 total_eus;
+
+	/** @total_threads: @total_eus * @threads_per_eu */
+	__u32 total_threads;
+
+	/** @l3_way_bytes: INTEL_HWCONFIG_L3_CACHE_WAYS_SIZE_IN_BYTES */
+	__u32 l3_way_bytes;
+
+	/** @l3_ways_per_sector: INTEL_HWCONFIG_L3_CACHE_WAYS_PER_SECTOR */
+	__u32 l3_ways_per_sector;
+
+	/** @reserved_ccs_ways: INTEL_HWCONFIG_RESERVED_CCS_WAYS */
+	__u32 reserved_ccs_ways;
+
+	/** @hbm_channels_per_tile: HBM stacks per tile * channels per stack */
+	__u32 hbm_channels_per_tile;
+
+	/**
+	 * @hbm_bus_bytes_per_tile: @hbm_channels_per_tile * channel width.
+	 *
+	 * Multiply by the memory transfer rate to get the peak HBM
+	 * bandwidth of one tile.
+	 */
+	__u32 hbm_bus_bytes_per_tile;
+
+	/**
+	 * @l3_bytes: L3 size in bytes.
+	 *
+	 * INTEL_HWCONFIG_L3_BANK_SIZE_IN_KB times the bank count, else the
+	 * deprecated INTEL_HWCONFIG_DEPRECATED_L3_CACHE_SIZE_IN_KB. The
+	 * product of @l3_way_bytes and @l3_ways_per_sector is the size of
+	 * one sector only, not of the L3.
+	 */
+	__u64 l3_bytes;
+
+	/**
+	 * @slm_bytes_per_dss: INTEL_HWCONFIG_SLM_SIZE_PER_SS_IN_KB or
+	 * INTEL_HWCONFIG_SLM_SIZE_PER_DSS in bytes, deprecated key as fallback
+	 */
+	__u64 slm_bytes_per_dss;
+};
+
+/**
+ * intel_hwconfig_capacity_init - Derive device capacity from an indexed view
+ * @cap: capacity to fill
+ * @view: view filled by intel_hwconfig_view_init()
+ */
+static inline void
+intel_hwconfig_capacity_init(struct intel_hwconfig_capacity *cap,
+			     const struct intel_hwconfig_view *view)
+{
+	__u32 slm_kb, banks;
+
+	cap->slices = intel_hwconfig_view_get(view, INTEL_HWCONFIG_MAX_SLICES_SUPPORTED, 0);
+	cap->dual_subslices = intel_hwconfig_view_get(view, INTEL_HWCONFIG_MAX_DUAL_SUBSLICES_SUPPORTED, 0);
+	cap->eus_per_dss = intel_hwconfig_view_get(view, INTEL_HWCONFIG_MAX_NUM_EU_PER_DSS, 0);
+	cap->threads_per_eu = intel_hwconfig_view_get(view, INTEL_HWCONFIG_NUM_THREADS_PER_EU, 0);
+	cap->total_eus = cap->dual_subslices * cap->eus_per_dss;
+	cap->total_threads = cap->total_eus * cap->threads_per_eu;
+
+	cap->l3_way_bytes = intel_hwconfig_view_get(view, INTEL_HWCONFIG_L3_CACHE_WAYS_SIZE_IN_BYTES, 0);
+	cap->l3_ways_per_sector = intel_hwconfig_view_get(view, INTEL_HWCONFIG_L3_CACHE_WAYS_PER_SECTOR, 0);
+	cap->reserved_ccs_ways = intel_hwconfig_view_get(view, INTEL_HWCONFIG_RESERVED_CCS_WAYS, 0);
+
+	cap->hbm_channels_per_tile =
+		intel_hwconfig_view_get(view, INTEL_HWCONFIG_NUM_HBM_STACKS_PER_TILE, 0) *
+		intel_hwconfig_view_get(view, INTEL_HWCONFIG_NUM_CHANNELS_PER_HBM_STACK, 0);
+	cap->hbm_bus_bytes_per_tile = cap->hbm_channels_per_tile *
+		intel_hwconfig_view_get(view, INTEL_HWCONFIG_HBM_CHANNEL_WIDTH_IN_BYTES, 0);
+
+	/* No current key carries the bank count, the deprecated one is all there is */
+	banks = intel_hwconfig_view_get(view, INTEL_HWCONFIG_DEPRECATED_L3_BANK_COUNT, 0);
+	cap->l3_bytes = (__u64)intel_hwconfig_view_get(view, INTEL_HWCONFIG_L3_BANK_SIZE_IN_KB, 0) *
+			banks * 1024;
+	if (!cap->l3_bytes)
+		cap->l3_bytes = (__u64)intel_hwconfig_view_get(view, INTEL_HWCONFIG_DEPRECATED_L3_CACHE_SIZE_IN_KB, 0) * 1024;
+
+	slm_kb = intel_hwconfig_view_get(view, INTEL_HWCONFIG_SLM_SIZE_PER_SS_IN_KB, 0);
+	if (!slm_kb)
+		slm_kb = intel_hwconfig_view_get(view, INTEL_HWCONFIG_SLM_SIZE_PER_DSS, 0);
+	if (!slm_kb)
+		slm_kb = intel_hwconfig_view_get(view, INTEL_HWCONFIG_DEPRECATED_SLM_SIZE_IN_KB, 0);
+	cap->slm_bytes_per_dss = (__u64)slm_kb * 1024;
+}
+
+#endif /* _INTEL_HWCONFIG_KLV_H_ */